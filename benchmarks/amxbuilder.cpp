@@ -0,0 +1,121 @@
+#include <cassert>
+#include <cstring>
+
+#include "amxbuilder.h"
+
+AMXBuilder::AMXBuilder() {
+  // Publics return to address 0, so that's where the "halt 0" goes.
+  Emit(AMX_OP_HALT, 0);
+}
+
+AMXBuilder::Label AMXBuilder::NewLabel() {
+  labels_.push_back(-1);
+  return static_cast<Label>(labels_.size() - 1);
+}
+
+void AMXBuilder::Bind(Label label) {
+  labels_[label] = Here();
+}
+
+void AMXBuilder::Emit(AMXOpcode opcode) {
+  code_.push_back(RelocateAMXOpcode(opcode));
+}
+
+void AMXBuilder::Emit(AMXOpcode opcode, cell param) {
+  Emit(opcode);
+  code_.push_back(param);
+}
+
+void AMXBuilder::EmitJump(AMXOpcode opcode, Label target) {
+  Emit(opcode);
+  Fixup fixup = {code_.size(), target};
+  fixups_.push_back(fixup);
+  code_.push_back(0);
+}
+
+cell AMXBuilder::Here() const {
+  return static_cast<cell>(code_.size() * sizeof(cell));
+}
+
+void AMXBuilder::AddPublic(const std::string &name, Label entry) {
+  publics_.push_back(std::make_pair(name, entry));
+}
+
+void AMXBuilder::AddNative(const std::string &name) {
+  natives_.push_back(name);
+}
+
+void AMXBuilder::Build(AMX *amx, cell data_size, cell stack_size) {
+  std::size_t num_entries = publics_.size() + natives_.size();
+  std::size_t names_size = sizeof(uint16_t);
+  for (std::size_t i = 0; i < publics_.size(); i++) {
+    names_size += publics_[i].first.length() + 1;
+  }
+  for (std::size_t i = 0; i < natives_.size(); i++) {
+    names_size += natives_[i].length() + 1;
+  }
+
+  AMX_HEADER hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = AMX_MAGIC;
+  hdr.file_version = 8;
+  hdr.amx_version = 8;
+  hdr.defsize = sizeof(AMX_FUNCSTUBNT);
+  hdr.publics = sizeof(AMX_HEADER);
+  hdr.natives = hdr.publics + publics_.size() * sizeof(AMX_FUNCSTUBNT);
+  hdr.libraries = hdr.natives + natives_.size() * sizeof(AMX_FUNCSTUBNT);
+  hdr.pubvars = hdr.libraries;
+  hdr.tags = hdr.libraries;
+  hdr.nametable = hdr.libraries;
+  hdr.cod = (hdr.nametable + names_size + sizeof(cell) - 1)
+            & ~(sizeof(cell) - 1);
+  hdr.dat = hdr.cod + code_.size() * sizeof(cell);
+  hdr.hea = hdr.dat + data_size;
+  hdr.stp = hdr.hea + stack_size;
+  hdr.size = hdr.hea;
+  hdr.cip = -1;
+  assert(num_entries * sizeof(AMX_FUNCSTUBNT)
+         == static_cast<std::size_t>(hdr.nametable - hdr.publics));
+
+  image_.assign(hdr.stp, 0);
+  unsigned char *base = image_.data();
+  unsigned char *code = base + hdr.cod;
+  std::memcpy(base, &hdr, sizeof(hdr));
+
+  AMX_FUNCSTUBNT *entries =
+    reinterpret_cast<AMX_FUNCSTUBNT*>(base + hdr.publics);
+  unsigned char *name = base + hdr.nametable;
+  *reinterpret_cast<uint16_t*>(name) = sNAMEMAX;
+  name += sizeof(uint16_t);
+
+  for (std::size_t i = 0; i < publics_.size(); i++) {
+    entries->address = labels_[publics_[i].second];
+    entries->nameofs = static_cast<uint32_t>(name - base);
+    std::strcpy(reinterpret_cast<char*>(name), publics_[i].first.c_str());
+    name += publics_[i].first.length() + 1;
+    entries++;
+  }
+  for (std::size_t i = 0; i < natives_.size(); i++) {
+    entries->address = 0;
+    entries->nameofs = static_cast<uint32_t>(name - base);
+    std::strcpy(reinterpret_cast<char*>(name), natives_[i].c_str());
+    name += natives_[i].length() + 1;
+    entries++;
+  }
+
+  // Jump targets are stored as absolute addresses, like RELOC_ABS does.
+  for (std::size_t i = 0; i < fixups_.size(); i++) {
+    assert(labels_[fixups_[i].label] >= 0);
+    code_[fixups_[i].index] = reinterpret_cast<cell>(
+      code + labels_[fixups_[i].label]);
+  }
+  std::memcpy(code, code_.data(), code_.size() * sizeof(cell));
+
+  std::memset(amx, 0, sizeof(*amx));
+  amx->base = base;
+  amx->flags = AMX_FLAG_RELOC | AMX_FLAG_NTVREG;
+  amx->hlw = hdr.hea - hdr.dat;
+  amx->hea = amx->hlw;
+  amx->stp = hdr.stp - hdr.dat - sizeof(cell);
+  amx->stk = amx->stp;
+}
@@ -0,0 +1,51 @@
+#ifndef AMXBUILDER_H
+#define AMXBUILDER_H
+
+#include <string>
+#include <vector>
+
+#include <amx/amx.h>
+
+#include "amxopcode.h"
+
+// Assembles a tiny AMX image in memory so that benchmarks don't depend on the
+// Pawn compiler. The code is relocated the same way amx_Init() would do it
+// with the executor's opcode table.
+class AMXBuilder {
+ public:
+  typedef int Label;
+
+  AMXBuilder();
+
+  Label NewLabel();
+  void Bind(Label label);
+
+  void Emit(AMXOpcode opcode);
+  void Emit(AMXOpcode opcode, cell param);
+  void EmitJump(AMXOpcode opcode, Label target);
+
+  // Returns the current code offset.
+  cell Here() const;
+
+  void AddPublic(const std::string &name, Label entry);
+  void AddNative(const std::string &name);
+
+  // Builds the image and initializes the AMX. The image is owned by the
+  // builder and must outlive the AMX.
+  void Build(AMX *amx, cell data_size, cell stack_size);
+
+ private:
+  struct Fixup {
+    std::size_t index;
+    Label label;
+  };
+
+  std::vector<cell> code_;
+  std::vector<cell> labels_;
+  std::vector<Fixup> fixups_;
+  std::vector<std::pair<std::string, Label>> publics_;
+  std::vector<std::string> natives_;
+  std::vector<unsigned char> image_;
+};
+
+#endif // !AMXBUILDER_H
@@ -0,0 +1,258 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <amx/amx.h>
+#include <amx/amxdbg.h>
+
+#include "amxdebuginfo.h"
+
+// Measures address lookups in the debug info (line, file and function at a
+// code address), as done for every frame of a backtrace, and variable
+// lookups by name as done by the debugger. Each lookup is timed with
+// AMXDebugInfo and with a plain scan over the raw tables, which is how
+// AMXDebugInfo (or dbg_GetVariable()) used to do it.
+//
+// Usage: debuginfo-bench [file.amx | num_lines]
+//
+// Without a file a script with 60000 lines is generated, about what
+// tools/65k.py produces.
+
+namespace {
+
+const int kLinesPerFunction = 10;
+const int kLinesPerFile = 1000;
+const cell kLineSize = 8 * sizeof(cell);
+
+template<typename T>
+void Put(std::vector<unsigned char> &buffer, T value) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(&value);
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+}
+
+void PutString(std::vector<unsigned char> &buffer, const std::string &s) {
+  buffer.insert(buffer.end(), s.begin(), s.end());
+  buffer.push_back('\0');
+}
+
+// Writes an .amx file with an empty code section and debug info for
+// num_lines lines.
+bool GenerateDebugInfo(const char *filename, int num_lines) {
+  int num_functions = (num_lines + kLinesPerFunction - 1) / kLinesPerFunction;
+  int num_files = (num_lines + kLinesPerFile - 1) / kLinesPerFile;
+
+  std::vector<unsigned char> tables;
+  for (int i = 0; i < num_files; i++) {
+    Put<ucell>(tables, i * kLinesPerFile * kLineSize);
+    PutString(tables, "file" + std::to_string(i) + ".pwn");
+  }
+  for (int i = 0; i < num_lines; i++) {
+    Put<ucell>(tables, i * kLineSize);
+    Put<int32_t>(tables, i % kLinesPerFile + 1);
+  }
+  for (int i = 0; i < num_functions; i++) {
+    cell start = i * kLinesPerFunction * kLineSize;
+    cell end = start + kLinesPerFunction * kLineSize;
+    // A local variable in front of each function, like the compiler does.
+    // Its scope ends at the function's RETN.
+    Put<ucell>(tables, -static_cast<cell>(sizeof(cell)));
+    Put<uint16_t>(tables, 0);
+    Put<ucell>(tables, start);
+    Put<ucell>(tables, end - sizeof(cell));
+    Put<char>(tables, AMXDebugSymbol::Variable);
+    Put<char>(tables, AMXDebugSymbol::Local);
+    Put<uint16_t>(tables, 0);
+    PutString(tables, "x");
+    Put<ucell>(tables, start);
+    Put<uint16_t>(tables, 0);
+    Put<ucell>(tables, start);
+    Put<ucell>(tables, end);
+    Put<char>(tables, AMXDebugSymbol::Function);
+    Put<char>(tables, AMXDebugSymbol::Global);
+    Put<uint16_t>(tables, 0);
+    PutString(tables, "function" + std::to_string(i));
+  }
+
+  AMX_HEADER amxhdr;
+  std::memset(&amxhdr, 0, sizeof(amxhdr));
+  amxhdr.size = sizeof(amxhdr);
+  amxhdr.magic = AMX_MAGIC;
+  amxhdr.flags = AMX_FLAG_DEBUG;
+
+  AMX_DBG_HDR dbghdr;
+  std::memset(&dbghdr, 0, sizeof(dbghdr));
+  dbghdr.size = static_cast<uint32_t>(sizeof(dbghdr) + tables.size());
+  dbghdr.magic = AMX_DBG_MAGIC;
+  dbghdr.files = static_cast<uint16_t>(num_files);
+  dbghdr.lines = static_cast<uint16_t>(num_lines);
+  dbghdr.symbols = static_cast<uint16_t>(2 * num_functions);
+
+  std::FILE *fp = std::fopen(filename, "wb");
+  if (fp == 0) {
+    return false;
+  }
+  std::fwrite(&amxhdr, sizeof(amxhdr), 1, fp);
+  std::fwrite(&dbghdr, sizeof(dbghdr), 1, fp);
+  std::fwrite(tables.data(), 1, tables.size(), fp);
+  std::fclose(fp);
+  return true;
+}
+
+// The lookups as they were done before AMXDebugInfo had its indexes.
+
+AMXDebugLine ScanLine(const AMXDebugInfo &info, cell address) {
+  AMXDebugInfo::LineTable lines = info.GetLines();
+  for (AMXDebugInfo::LineTable::const_reverse_iterator it = lines.crbegin();
+       it != lines.crend(); ++it) {
+    if (it->GetAddress() <= address) {
+      return *it;
+    }
+  }
+  return AMXDebugLine();
+}
+
+AMXDebugFile ScanFile(const AMXDebugInfo &info, cell address) {
+  AMXDebugInfo::FileTable files = info.GetFiles();
+  for (AMXDebugInfo::FileTable::const_reverse_iterator it = files.crbegin();
+       it != files.crend(); ++it) {
+    if (it->GetAddress() <= address) {
+      return *it;
+    }
+  }
+  return AMXDebugFile();
+}
+
+AMXDebugSymbol ScanFunction(const AMXDebugInfo &info, cell address) {
+  AMXDebugInfo::SymbolTable symbols = info.GetSymbols();
+  for (AMXDebugInfo::SymbolTable::const_iterator it = symbols.begin();
+       it != symbols.end(); ++it) {
+    if (!it->IsFunction())
+      continue;
+    if (it->GetCodeStart() > address || it->GetCodeEnd() <= address)
+      continue;
+    if (it->GetName()[0] == '@')
+      continue;
+    return *it;
+  }
+  return AMXDebugSymbol();
+}
+
+AMXDebugSymbol ScanVariable(const AMXDebugInfo &info,
+                            const char *name,
+                            cell address) {
+  // Same as dbg_GetVariable().
+  AMXDebugSymbol variable;
+  AMXDebugInfo::SymbolTable symbols = info.GetSymbols();
+  for (AMXDebugInfo::SymbolTable::const_iterator it = symbols.begin();
+       it != symbols.end(); ++it) {
+    if (it->IsFunction() || std::strcmp(it->GetPOD()->name, name) != 0)
+      continue;
+    if (it->GetCodeStart() > address || it->GetCodeEnd() < address)
+      continue;
+    if (!variable
+        || (it->GetCodeStart() >= variable.GetCodeStart()
+            && it->GetCodeEnd() <= variable.GetCodeEnd())) {
+      variable = *it;
+    }
+  }
+  return variable;
+}
+
+template<typename Func>
+double Measure(const std::vector<cell> &addresses, Func func) {
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < addresses.size(); i++) {
+    func(addresses[i]);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count()
+         / addresses.size();
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  std::string filename = "debuginfo-bench.amx";
+  int num_lines = 60000;
+  if (argc > 1) {
+    if (std::atoi(argv[1]) > 0) {
+      num_lines = std::atoi(argv[1]);
+    } else {
+      filename = argv[1];
+      num_lines = 0;
+    }
+  }
+  if (num_lines > 0xFFFF) {
+    std::fprintf(stderr, "Too many lines: %d\n", num_lines);
+    return EXIT_FAILURE;
+  }
+  if (num_lines > 0 && !GenerateDebugInfo(filename.c_str(), num_lines)) {
+    std::fprintf(stderr, "Could not write %s\n", filename.c_str());
+    return EXIT_FAILURE;
+  }
+
+  AMXDebugInfo info(filename);
+  if (!info.IsLoaded()) {
+    std::fprintf(stderr, "Could not load debug info from %s\n",
+                 filename.c_str());
+    return EXIT_FAILURE;
+  }
+
+  AMXDebugInfo::LineTable lines = info.GetLines();
+  cell code_end = lines[lines.size() - 1].GetAddress() + kLineSize;
+  std::printf("%d lines, %d symbols, %d files\n",
+              static_cast<int>(lines.size()),
+              static_cast<int>(info.GetSymbols().size()),
+              static_cast<int>(info.GetFiles().size()));
+
+  std::srand(1);
+  std::vector<cell> addresses(100000);
+  for (std::size_t i = 0; i < addresses.size(); i++) {
+    addresses[i] = static_cast<cell>(
+      static_cast<double>(std::rand()) / RAND_MAX * code_end)
+      & ~(sizeof(cell) - 1);
+  }
+  std::vector<cell> few(addresses.begin(), addresses.begin() + 1000);
+
+  for (std::size_t i = 0; i < few.size(); i++) {
+    cell address = few[i];
+    if (ScanLine(info, address).GetNumber()
+          != info.GetLine(address).GetNumber()
+        || ScanFile(info, address).GetAddress()
+          != info.GetFile(address).GetAddress()
+        || ScanFunction(info, address).GetPOD()
+          != info.GetFunction(address).GetPOD()
+        || ScanVariable(info, "x", address).GetPOD()
+          != info.GetVariable("x", address).GetPOD()) {
+      std::fprintf(stderr, "Lookups disagree at 0x%x\n", address);
+      return EXIT_FAILURE;
+    }
+  }
+
+  volatile cell sink = 0;
+  std::printf("%-10s %12s %12s\n", "lookup", "scan, ns", "index, ns");
+  std::printf("%-10s %12.1f %12.1f\n", "line",
+    Measure(few, [&](cell a) { sink += ScanLine(info, a).GetNumber(); }),
+    Measure(addresses, [&](cell a) { sink += info.GetLine(a).GetNumber(); }));
+  std::printf("%-10s %12.1f %12.1f\n", "file",
+    Measure(few, [&](cell a) { sink += ScanFile(info, a).GetAddress(); }),
+    Measure(addresses, [&](cell a) {
+      sink += info.GetFile(a).GetAddress();
+    }));
+  std::printf("%-10s %12.1f %12.1f\n", "function",
+    Measure(few, [&](cell a) { sink += ScanFunction(info, a) ? 1 : 0; }),
+    Measure(addresses, [&](cell a) {
+      sink += info.GetFunction(a) ? 1 : 0;
+    }));
+  std::string x = "x";
+  std::printf("%-10s %12.1f %12.1f\n", "variable",
+    Measure(few, [&](cell a) { sink += ScanVariable(info, "x", a) ? 1 : 0; }),
+    Measure(addresses, [&](cell a) {
+      sink += info.GetVariable(x, a) ? 1 : 0;
+    }));
+
+  return EXIT_SUCCESS;
+}
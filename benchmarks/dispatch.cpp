@@ -0,0 +1,163 @@
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <amx/amx.h>
+
+#include "amxbuilder.h"
+#include "amxexecutor.h"
+#include "amxprofiler.h"
+#include "amxsampler.h"
+#include "logprintf.h"
+
+// Measures raw interpreter throughput: a public runs a loop that exercises
+// the usual mix of loads, stores, arithmetic, branches, calls and a native
+// call, with nothing else enabled in the executor. With a sample rate it
+// runs the sampling profiler at that rate too, to see what it costs.
+//
+// Usage: dispatch-bench [iterations] [fuse|nofuse] [samples per second]
+
+namespace {
+
+const cell kGlobal0 = 0;
+const cell kGlobal1 = sizeof(cell);
+
+// Instructions executed per iteration of the loop below, counting the four
+// in the called function.
+const long kInstructionsPerIteration = 20;
+
+void LogPrintf(const char *format, ...) {
+  std::va_list va;
+  va_start(va, format);
+  std::vprintf(format, va);
+  std::printf("\n");
+  va_end(va);
+}
+
+int AMXAPI Callback(AMX *amx, cell index, cell *result, cell *params) {
+  *result = 0;
+  return AMX_ERR_NONE;
+}
+
+void BuildLoop(AMXBuilder &builder, cell iterations) {
+  AMXBuilder::Label main = builder.NewLabel();
+  AMXBuilder::Label loop = builder.NewLabel();
+  AMXBuilder::Label done = builder.NewLabel();
+  AMXBuilder::Label inc = builder.NewLabel();
+
+  // inc(x) return x + 1;
+  builder.Bind(inc);
+  builder.Emit(AMX_OP_PROC);
+  builder.Emit(AMX_OP_LOAD_S_PRI, 3 * sizeof(cell));
+  builder.Emit(AMX_OP_ADD_C, 1);
+  builder.Emit(AMX_OP_RETN);
+
+  // public main() {
+  //   for (new i = 0; i < iterations; i++) {
+  //     g0 += 3;
+  //     g1 = inc(i);
+  //     native();
+  //   }
+  // }
+  builder.Bind(main);
+  builder.Emit(AMX_OP_PROC);
+  builder.Emit(AMX_OP_PUSH_C, 0);
+  builder.Bind(loop);
+  builder.Emit(AMX_OP_LOAD_S_PRI, -static_cast<cell>(sizeof(cell)));
+  builder.Emit(AMX_OP_CONST_ALT, iterations);
+  builder.EmitJump(AMX_OP_JSGEQ, done);
+  builder.Emit(AMX_OP_LOAD_PRI, kGlobal0);
+  builder.Emit(AMX_OP_ADD_C, 3);
+  builder.Emit(AMX_OP_STOR_PRI, kGlobal0);
+  builder.Emit(AMX_OP_LOAD_S_PRI, -static_cast<cell>(sizeof(cell)));
+  builder.Emit(AMX_OP_PUSH_PRI);
+  builder.Emit(AMX_OP_PUSH_C, sizeof(cell));
+  builder.EmitJump(AMX_OP_CALL, inc);
+  builder.Emit(AMX_OP_STOR_PRI, kGlobal1);
+  builder.Emit(AMX_OP_PUSH_C, 0);
+  builder.Emit(AMX_OP_SYSREQ_C, 0);
+  builder.Emit(AMX_OP_STACK, sizeof(cell));
+  builder.Emit(AMX_OP_INC_S, -static_cast<cell>(sizeof(cell)));
+  builder.EmitJump(AMX_OP_JUMP, loop);
+  builder.Bind(done);
+  builder.Emit(AMX_OP_STACK, sizeof(cell));
+  builder.Emit(AMX_OP_ZERO_PRI);
+  builder.Emit(AMX_OP_RETN);
+
+  builder.AddPublic("main", main);
+  builder.AddNative("native");
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  ::logprintf = LogPrintf;
+
+  cell iterations = 10000000;
+  if (argc > 1) {
+    iterations = std::atoi(argv[1]);
+  }
+  bool fuse = argc > 2 && std::strcmp(argv[2], "fuse") == 0;
+  int profile_rate = 0;
+  if (argc > 3) {
+    profile_rate = std::atoi(argv[3]);
+  }
+
+  AMX amx;
+  AMXBuilder builder;
+  BuildLoop(builder, iterations);
+  builder.Build(&amx, 2 * sizeof(cell), 4096);
+  amx_SetCallback(&amx, Callback);
+
+  AMXExecutor *executor = AMXExecutor::GetInstance(&amx);
+  executor->Load();
+  if (fuse) {
+    std::printf("%d superinstructions\n", executor->FuseInstructions());
+  }
+
+  AMXProfiler profiler;
+  AMXSampler sampler;
+  if (profile_rate > 0) {
+    executor->set_profiler(&profiler);
+    sampler.Add(executor, &profiler);
+    sampler.Start(profile_rate);
+  }
+
+  cell retval = 0;
+  auto start = std::chrono::steady_clock::now();
+  int error = executor->HandleAMXExec(&retval, 0);
+  auto end = std::chrono::steady_clock::now();
+
+  if (profile_rate > 0) {
+    sampler.Stop();
+    sampler.Remove(executor);
+    executor->set_profiler(0);
+    profiler.Collect();
+    std::printf("%llu samples, %llu dropped\n",
+                static_cast<unsigned long long>(profiler.num_samples()),
+                static_cast<unsigned long long>(profiler.num_dropped()));
+  }
+
+  if (error != AMX_ERR_NONE) {
+    std::fprintf(stderr, "amx_Exec() failed with error %d\n", error);
+    return EXIT_FAILURE;
+  }
+
+  cell *data = reinterpret_cast<cell*>(
+    amx.base + reinterpret_cast<AMX_HEADER*>(amx.base)->dat);
+  if (data[0] != 3 * iterations || data[1] != iterations) {
+    std::fprintf(stderr, "Wrong result: %d, %d\n", data[0], data[1]);
+    return EXIT_FAILURE;
+  }
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  double instructions =
+    static_cast<double>(iterations) * kInstructionsPerIteration;
+  std::printf("%.0f instructions in %.3f s, %.1f M/s\n",
+              instructions, seconds, instructions / seconds / 1e6);
+
+  AMXExecutor::DestroyInstance(&amx);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include <amx/amx.h>
+
+#include "amxbuilder.h"
+#include "amxexecutor.h"
+#include "amxservice.h"
+#include "logprintf.h"
+
+// Measures what finding the plugin's per-script objects adds to a native
+// call: the script calls a native in a loop and the AMX callback looks up a
+// service instance before calling it, the way AmxCallback in plugin.cpp
+// does. This is compared with a bare callback and with a lookup in a
+// std::map, which is what AMXService used before.
+//
+// Usage: registry-bench [calls] [scripts]
+
+namespace {
+
+class Counter : public AMXService<Counter> {
+ friend class AMXService<Counter>;
+ public:
+  void Increment() { count_++; }
+  long count() const { return count_; }
+ private:
+  Counter(AMX *amx) : AMXService<Counter>(amx), count_(0) {}
+  long count_;
+};
+
+std::map<AMX*, long*> counter_map;
+
+void LogPrintf(const char *format, ...) {
+  std::va_list va;
+  va_start(va, format);
+  std::vprintf(format, va);
+  std::printf("\n");
+  va_end(va);
+}
+
+int AMXAPI BareCallback(AMX *amx, cell index, cell *result, cell *params) {
+  *result = 0;
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI MapCallback(AMX *amx, cell index, cell *result, cell *params) {
+  (*counter_map.find(amx)->second)++;
+  *result = 0;
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI ServiceCallback(AMX *amx, cell index, cell *result, cell *params) {
+  Counter::GetInstance(amx)->Increment();
+  *result = 0;
+  return AMX_ERR_NONE;
+}
+
+void BuildLoop(AMXBuilder &builder, cell calls) {
+  AMXBuilder::Label main = builder.NewLabel();
+  AMXBuilder::Label loop = builder.NewLabel();
+
+  // public main() {
+  //   for (new i = calls; i != 0; i--) native();
+  // }
+  builder.Bind(main);
+  builder.Emit(AMX_OP_PROC);
+  builder.Emit(AMX_OP_PUSH_C, calls);
+  builder.Bind(loop);
+  builder.Emit(AMX_OP_PUSH_C, 0);
+  builder.Emit(AMX_OP_SYSREQ_C, 0);
+  builder.Emit(AMX_OP_STACK, sizeof(cell));
+  builder.Emit(AMX_OP_DEC_S, -static_cast<cell>(sizeof(cell)));
+  builder.Emit(AMX_OP_LOAD_S_PRI, -static_cast<cell>(sizeof(cell)));
+  builder.EmitJump(AMX_OP_JNZ, loop);
+  builder.Emit(AMX_OP_STACK, sizeof(cell));
+  builder.Emit(AMX_OP_RETN);
+
+  builder.AddPublic("main", main);
+  builder.AddNative("native");
+}
+
+double Run(AMX *amx, AMX_CALLBACK callback, cell calls) {
+  amx->callback = callback;
+  cell retval = 0;
+  auto start = std::chrono::steady_clock::now();
+  int error = AMXExecutor::GetInstance(amx)->HandleAMXExec(&retval, 0);
+  auto end = std::chrono::steady_clock::now();
+  if (error != AMX_ERR_NONE) {
+    std::fprintf(stderr, "amx_Exec() failed with error %d\n", error);
+    std::exit(EXIT_FAILURE);
+  }
+  return std::chrono::duration<double, std::nano>(end - start).count() / calls;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  ::logprintf = LogPrintf;
+
+  cell calls = 10000000;
+  int num_scripts = 17; // a gamemode and 16 filterscripts
+  if (argc > 1) {
+    calls = std::atoi(argv[1]);
+  }
+  if (argc > 2) {
+    num_scripts = std::atoi(argv[2]);
+  }
+  if (calls <= 0 || num_scripts <= 0) {
+    std::fprintf(stderr, "Usage: %s [calls] [scripts]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // Other scripts only populate the registries.
+  std::vector<AMX> others(num_scripts - 1);
+  std::vector<long> other_counts(others.size());
+  for (std::size_t i = 0; i < others.size(); i++) {
+    Counter::CreateInstance(&others[i]);
+    counter_map[&others[i]] = &other_counts[i];
+  }
+
+  AMX amx;
+  AMXBuilder builder;
+  BuildLoop(builder, calls);
+  builder.Build(&amx, sizeof(cell), 4096);
+  AMXExecutor::GetInstance(&amx)->Load();
+
+  long map_count = 0;
+  counter_map[&amx] = &map_count;
+  Counter *counter = Counter::CreateInstance(&amx);
+
+  double bare = Run(&amx, BareCallback, calls);
+  double map = Run(&amx, MapCallback, calls);
+  double service = Run(&amx, ServiceCallback, calls);
+
+  if (map_count != calls || counter->count() != calls) {
+    std::fprintf(stderr, "Wrong number of calls: %ld, %ld\n",
+                 map_count, counter->count());
+    return EXIT_FAILURE;
+  }
+
+  std::printf("%d scripts, %d native calls\n", num_scripts, calls);
+  std::printf("bare callback:      %6.2f ns/call\n", bare);
+  std::printf("std::map lookup:    %6.2f ns/call (+%.2f)\n", map, map - bare);
+  std::printf("AMXService lookup:  %6.2f ns/call (+%.2f)\n",
+              service, service - bare);
+
+  Counter::DestroyInstance(&amx);
+  AMXExecutor::DestroyInstance(&amx);
+  return EXIT_SUCCESS;
+}
@@ -13,8 +13,9 @@ include(CMakeParseArguments)
 function(add_samp_plugin_test)
   set(name "${ARGV0}")
 
-  set(options TARGET OUTPUT_FILE SCRIPT TIMEOUT CONFIG WORKING_DIRECTORY)
-  cmake_parse_arguments(ARG "" "${options}" "" ${ARGN})
+  set(options TARGET OUTPUT_FILE SCRIPT TIMEOUT WORKING_DIRECTORY)
+  set(lists CONFIG)
+  cmake_parse_arguments(ARG "" "${options}" "${lists}" ${ARGN})
 
   find_package(SAMPServerCLI REQUIRED)
   set(command ${SAMPServerCLI_EXECUTABLE})
@@ -27,6 +28,12 @@ function(add_samp_plugin_test)
     list(APPEND args --timeout ${ARG_TIMEOUT})
   endif()
 
+  # CONFIG is a list of "name value" server.cfg options.
+  foreach(option ${ARG_CONFIG})
+    string(REPLACE " " ";" option ${option})
+    list(APPEND args --extra ${option})
+  endforeach()
+
   if(ARG_WORKING_DIRECTORY)
     list(APPEND args --workdir ${ARG_WORKING_DIRECTORY})
   endif()
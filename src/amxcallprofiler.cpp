@@ -0,0 +1,251 @@
+#include <chrono>
+#include <ostream>
+
+#if defined _MSC_VER
+  #include <intrin.h>
+#elif defined __i386__ || defined __x86_64__
+  #include <x86intrin.h>
+#endif
+
+#include "amxcallprofiler.h"
+#include "amxdebuginfo.h"
+
+AMXCallProfiler::AMXCallProfiler(AMXScript amx, const AMXProgram &program)
+ : amx_(amx),
+   program_(program),
+   slots_(program.num_instructions(), -1),
+   natives_(amx.GetNumNatives()),
+   stack_(kMaxDepth),
+   depth_(0)
+{
+  // Functions first, so that calls can refer to functions further down.
+  for (const AMXInstruction *i = program.begin(); i != program.end(); i++) {
+    if (program.GetOpcode(i) == AMX_OP_PROC) {
+      Function function = {i->address, 0, 0};
+      slots_[i - program.begin()] = static_cast<int>(functions_.size());
+      functions_.push_back(function);
+    }
+  }
+  for (std::size_t i = 0; i < natives_.size(); i++) {
+    natives_[i].address = static_cast<cell>(i);
+    natives_[i].calls = 0;
+    natives_[i].self = 0;
+  }
+
+  int caller = -1;
+  for (const AMXInstruction *i = program.begin(); i != program.end(); i++) {
+    Call call = {i->address, caller, -1, false, 0, 0};
+    switch (program.GetOpcode(i)) {
+      case AMX_OP_PROC:
+        caller = GetSlot(i);
+        continue;
+      case AMX_OP_CALL:
+        if (i->target == program.end()
+            || program.GetOpcode(i->target) != AMX_OP_PROC) {
+          continue;
+        }
+        call.callee = GetSlot(i->target);
+        break;
+      case AMX_OP_SYSREQ_C:
+        if (i->operand < 0
+            || i->operand >= static_cast<cell>(natives_.size())) {
+          continue;
+        }
+        call.callee = i->operand;
+        call.is_native = true;
+        break;
+      default:
+        continue;
+    }
+    if (caller >= 0) {
+      slots_[i - program.begin()] = static_cast<int>(calls_.size());
+      calls_.push_back(call);
+    }
+  }
+}
+
+// static
+uint64_t AMXCallProfiler::Now() {
+#if defined _MSC_VER || defined __i386__ || defined __x86_64__
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void AMXCallProfiler::Enter(const AMXInstruction *proc,
+                            cell frm,
+                            cell return_address) {
+  uint64_t now = Now();
+
+  // The stack grows down, so frames at or below this one belong to calls
+  // that never returned: the script was aborted or went to sleep.
+  while (depth_ > 0 && stack_[depth_ - 1].frm <= frm) {
+    Leave(now);
+  }
+  if (depth_ == kMaxDepth) {
+    return;
+  }
+
+  Frame &frame = stack_[depth_++];
+  frame.function = GetSlot(proc);
+  frame.call = -1;
+  frame.frm = frm;
+  frame.children = 0;
+  functions_[frame.function].calls++;
+
+  if (return_address != 0) {
+    const AMXInstruction *site = program_.FindPrevious(return_address);
+    if (site != 0) {
+      int call = GetSlot(site);
+      if (call >= 0
+          && !calls_[call].is_native
+          && calls_[call].callee == frame.function) {
+        frame.call = call;
+      }
+    }
+  }
+
+  // Start the clock last so that the above isn't counted.
+  frame.start = Now();
+}
+
+void AMXCallProfiler::Exit(cell frm) {
+  uint64_t now = Now();
+  while (depth_ > 0 && stack_[depth_ - 1].frm < frm) {
+    Leave(now);
+  }
+  if (depth_ > 0 && stack_[depth_ - 1].frm == frm) {
+    Leave(now);
+  }
+}
+
+void AMXCallProfiler::Native(const AMXInstruction *sysreq,
+                             cell index,
+                             uint64_t start) {
+  uint64_t elapsed = Now() - start;
+
+  if (index >= 0 && index < static_cast<cell>(natives_.size())) {
+    natives_[index].calls++;
+    natives_[index].self += elapsed;
+  }
+  int call = GetSlot(sysreq);
+  if (call >= 0 && calls_[call].is_native && calls_[call].callee == index) {
+    calls_[call].count++;
+    calls_[call].inclusive += elapsed;
+  }
+  if (depth_ > 0) {
+    stack_[depth_ - 1].children += elapsed;
+  }
+}
+
+void AMXCallProfiler::Leave(uint64_t now) {
+  const Frame &frame = stack_[--depth_];
+  uint64_t elapsed = now - frame.start;
+
+  // Clamped in case the cycle counters of different cores disagree.
+  functions_[frame.function].self +=
+    elapsed > frame.children ? elapsed - frame.children : 0;
+  if (frame.call >= 0) {
+    calls_[frame.call].count++;
+    calls_[frame.call].inclusive += elapsed;
+  }
+  if (depth_ > 0) {
+    stack_[depth_ - 1].children += elapsed;
+  }
+}
+
+void AMXCallProfiler::WriteCallgrind(std::ostream &stream,
+                                     const std::string &name,
+                                     const AMXDebugInfo &debug_info) const {
+  stream << "# callgrind format\n"
+         << "version: 1\n"
+         << "creator: Pawn debugger plugin\n"
+         << "cmd: " << name << "\n"
+         << "positions: instr line\n"
+         << "events: Cycles\n";
+
+  // Calls are grouped by caller below, and callers are in code order.
+  std::size_t call = 0;
+  for (std::size_t i = 0; i < functions_.size(); i++) {
+    const Function &function = functions_[i];
+    std::size_t first_call = call;
+    while (call < calls_.size()
+           && calls_[call].caller == static_cast<int>(i)) {
+      call++;
+    }
+    if (function.calls == 0) {
+      continue;
+    }
+
+    stream << "\n";
+    WriteFunctionName(stream, "", function, debug_info);
+    WritePosition(stream, function.address, debug_info);
+    stream << " " << function.self << "\n";
+
+    for (std::size_t j = first_call; j < call; j++) {
+      const Call &edge = calls_[j];
+      if (edge.count == 0) {
+        continue;
+      }
+      if (edge.is_native) {
+        const char *native = amx_.GetNativeName(edge.callee);
+        stream << "cfl=(natives)\n"
+               << "cfn=" << (native != 0 ? native : "(unknown)") << "\n"
+               << "calls=" << edge.count << " 0 0\n";
+      } else {
+        const Function &callee = functions_[edge.callee];
+        WriteFunctionName(stream, "c", callee, debug_info);
+        stream << "calls=" << edge.count << " ";
+        WritePosition(stream, callee.address, debug_info);
+        stream << "\n";
+      }
+      WritePosition(stream, edge.address, debug_info);
+      stream << " " << edge.inclusive << "\n";
+    }
+  }
+
+  for (std::size_t i = 0; i < natives_.size(); i++) {
+    if (natives_[i].calls == 0) {
+      continue;
+    }
+    const char *native = amx_.GetNativeName(static_cast<int>(i));
+    stream << "\n"
+           << "fl=(natives)\n"
+           << "fn=" << (native != 0 ? native : "(unknown)") << "\n"
+           << "0 0 " << natives_[i].self << "\n";
+  }
+}
+
+void AMXCallProfiler::WritePosition(std::ostream &stream,
+                                    cell address,
+                                    const AMXDebugInfo &debug_info) const {
+  int32_t line = -1;
+  if (debug_info.IsLoaded()) {
+    line = debug_info.GetLineNumber(address);
+  }
+  stream << "0x" << std::hex << address << std::dec << " " << line + 1;
+}
+
+void AMXCallProfiler::WriteFunctionName(std::ostream &stream,
+                                        const char *prefix,
+                                        const Function &function,
+                                        const AMXDebugInfo &debug_info) const {
+  std::string file;
+  std::string name;
+  if (debug_info.IsLoaded()) {
+    file = debug_info.GetFileName(function.address);
+    name = debug_info.GetFunctionName(function.address);
+  }
+  if (file.empty()) {
+    file = "(unknown)";
+  }
+  stream << prefix << "fl=" << file << "\n";
+  if (name.empty()) {
+    stream << prefix << "fn=0x" << std::hex << function.address << std::dec
+           << "\n";
+  } else {
+    stream << prefix << "fn=" << name << "\n";
+  }
+}
@@ -0,0 +1,104 @@
+#ifndef AMXCALLPROFILER_H
+#define AMXCALLPROFILER_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include <amx/amx.h>
+
+#include "amxprogram.h"
+#include "amxscript.h"
+
+class AMXDebugInfo;
+
+// Counts every call to a Pawn function or a native and how many cycles it
+// took. The executor reports function entries (PROC), returns (RET, RETN)
+// and native calls as they happen. Everything is counted in tables that
+// are laid out when the profiler is created, one slot per function, native
+// and call site, so nothing is allocated or looked up by name while the
+// script runs.
+//
+// Only used on the script's thread.
+class AMXCallProfiler {
+ public:
+  static const int kMaxDepth = 1024;
+
+  // The program must already be decoded and must outlive the profiler.
+  AMXCallProfiler(AMXScript amx, const AMXProgram &program);
+
+  // Reads the CPU's cycle counter (or a nanosecond clock where there's
+  // none).
+  static uint64_t Now();
+
+  // proc is the PROC instruction, frm the new frame and return_address what
+  // the caller pushed (0 for publics called by the server).
+  void Enter(const AMXInstruction *proc, cell frm, cell return_address);
+
+  // Called by RET and RETN with the frame that is being left.
+  void Exit(cell frm);
+
+  // Called after a SYSREQ returned. start is Now() from before the call.
+  void Native(const AMXInstruction *sysreq, cell index, uint64_t start);
+
+  // Writes a profile that KCachegrind and friends can open: the cost of
+  // every function itself plus every call site with how many times it was
+  // taken and its inclusive cost, in cycles. Positions are code addresses
+  // and, with debug info, source lines.
+  void WriteCallgrind(std::ostream &stream,
+                      const std::string &name,
+                      const AMXDebugInfo &debug_info) const;
+
+ private:
+  struct Function {
+    cell address;
+    uint64_t calls;
+    uint64_t self;
+  };
+
+  // An edge of the call graph. Calls through CALL.pri and SYSREQ.pri have
+  // no fixed callee and don't get one.
+  struct Call {
+    cell address;
+    int caller;
+    int callee; // function, or native if is_native
+    bool is_native;
+    uint64_t count;
+    uint64_t inclusive;
+  };
+
+  struct Frame {
+    int function;
+    int call;
+    cell frm;
+    uint64_t start;
+    uint64_t children;
+  };
+
+  void Leave(uint64_t now);
+
+  int GetSlot(const AMXInstruction *instruction) const {
+    return slots_[instruction - program_.begin()];
+  }
+
+  void WritePosition(std::ostream &stream,
+                     cell address,
+                     const AMXDebugInfo &debug_info) const;
+  void WriteFunctionName(std::ostream &stream,
+                         const char *prefix,
+                         const Function &function,
+                         const AMXDebugInfo &debug_info) const;
+
+ private:
+  AMXScript amx_;
+  const AMXProgram &program_;
+  std::vector<int> slots_; // per instruction: function or call, or -1
+  std::vector<Function> functions_;
+  std::vector<Function> natives_;
+  std::vector<Call> calls_;
+  std::vector<Frame> stack_;
+  int depth_;
+};
+
+#endif // !AMXCALLPROFILER_H
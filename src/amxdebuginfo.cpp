@@ -22,9 +22,11 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <limits>
 
 #include "amxdebuginfo.h"
 
@@ -40,6 +42,62 @@ std::vector<AMXDebugSymbolDim> AMXDebugSymbol::GetDims() const {
   return dims;
 }
 
+namespace {
+
+bool IsBuggedForward(const AMX_DBG_SYMBOL *symbol) {
+  // There seems to be a bug in Pawn compiler 3.2.3664 that adds
+  // forwarded publics to symbol table even if they are not implemented.
+  // Luckily it "works" only for those publics that start with '@'.
+  return (symbol->name[0] == '@');
+}
+
+bool LineAddressLess(const AMX_DBG_LINE &left, const AMX_DBG_LINE &right) {
+  return static_cast<cell>(left.address) < static_cast<cell>(right.address);
+}
+
+bool AddressLessThanLine(cell address, const AMX_DBG_LINE &line) {
+  return address < static_cast<cell>(line.address);
+}
+
+bool LineLessThanAddress(const AMX_DBG_LINE &line, cell address) {
+  return static_cast<cell>(line.address) < address;
+}
+
+bool FileAddressLess(const AMX_DBG_FILE *left, const AMX_DBG_FILE *right) {
+  return static_cast<cell>(left->address) < static_cast<cell>(right->address);
+}
+
+bool AddressLessThanFile(cell address, const AMX_DBG_FILE *file) {
+  return address < static_cast<cell>(file->address);
+}
+
+bool CodeStartLess(const AMX_DBG_SYMBOL *left, const AMX_DBG_SYMBOL *right) {
+  return static_cast<cell>(left->codestart)
+       < static_cast<cell>(right->codestart);
+}
+
+bool AddressLessThanCodeStart(cell address, const AMX_DBG_SYMBOL *symbol) {
+  return address < static_cast<cell>(symbol->codestart);
+}
+
+bool CodeStartLessThanAddress(const AMX_DBG_SYMBOL *symbol, cell address) {
+  return static_cast<cell>(symbol->codestart) < address;
+}
+
+bool IsInScope(const AMX_DBG_SYMBOL *symbol, cell address) {
+  // The end of a scope is inclusive, as in dbg_GetVariable().
+  return static_cast<cell>(symbol->codestart) <= address
+      && static_cast<cell>(symbol->codeend) >= address;
+}
+
+bool IsInnerScope(const AMX_DBG_SYMBOL *symbol, const AMX_DBG_SYMBOL *outer) {
+  return outer == 0
+      || (symbol->codestart >= outer->codestart
+          && symbol->codeend <= outer->codeend);
+}
+
+} // anonymous namespace
+
 AMXDebugInfo::AMXDebugInfo()
  : amxdbg_(0)
 {
@@ -65,6 +123,7 @@ void AMXDebugInfo::Load(const std::string &filename) {
     AMX_DBG amxdbg;
     if (dbg_LoadInfo(&amxdbg, fp) == AMX_ERR_NONE) {
       amxdbg_ = new AMX_DBG(amxdbg);
+      BuildIndexes();
     }
     fclose(fp);
   }
@@ -74,74 +133,163 @@ void AMXDebugInfo::Free() {
   if (amxdbg_ != 0) {
     dbg_FreeInfo(amxdbg_);
     delete amxdbg_;
+    amxdbg_ = 0;
   }
+  line_index_.clear();
+  file_index_.clear();
+  function_index_.clear();
+  function_scopes_.clear();
+  globals_.clear();
 }
 
-AMXDebugLine AMXDebugInfo::GetLine(cell address) const {
-  Line line;
+void AMXDebugInfo::BuildIndexes() {
+  // The compiler normally emits the tables in code order already. Sorting
+  // is stable so that entries with the same address keep their order.
   LineTable lines = GetLines();
-  for (LineTable::const_reverse_iterator it = lines.crbegin();
-       it != lines.crend(); ++it) {
-    if  (it->GetAddress() <= address) {
-      line = *it;
-      break;
+  line_index_.assign(amxdbg_->linetbl, amxdbg_->linetbl + lines.size());
+  std::stable_sort(line_index_.begin(), line_index_.end(), LineAddressLess);
+
+  FileTable files = GetFiles();
+  file_index_.assign(amxdbg_->filetbl, amxdbg_->filetbl + files.size());
+  std::stable_sort(file_index_.begin(), file_index_.end(), FileAddressLess);
+
+  SymbolTable symbols = GetSymbols();
+  function_index_.clear();
+  for (SymbolTable::const_iterator it = symbols.begin();
+       it != symbols.end(); ++it) {
+    if (it->IsFunction() && !IsBuggedForward(it->GetPOD())) {
+      function_index_.push_back(it->GetPOD());
+    }
+  }
+  std::stable_sort(function_index_.begin(), function_index_.end(),
+                   CodeStartLess);
+
+  function_scopes_.assign(function_index_.size(),
+                          std::vector<const AMX_DBG_SYMBOL*>());
+  globals_.clear();
+  for (SymbolTable::const_iterator it = symbols.begin();
+       it != symbols.end(); ++it) {
+    const AMX_DBG_SYMBOL *symbol = it->GetPOD();
+    if (it->IsFunction()) {
+      continue;
+    }
+    int function = FindFunction(symbol->codestart);
+    if (function >= 0
+        && symbol->codeend <= function_index_[function]->codeend) {
+      function_scopes_[function].push_back(symbol);
+    } else {
+      globals_.insert(std::make_pair(std::string_view(symbol->name), symbol));
     }
   }
-  return line;
 }
 
-AMXDebugFile AMXDebugInfo::GetFile(cell address) const {
-  File file;
-  FileTable files = GetFiles();
-  for (FileTable::const_reverse_iterator it = files.crbegin();
-       it != files.crend(); ++it) {
-    if  (it->GetAddress() <= address) {
-      file = *it;
-      break;
+int AMXDebugInfo::FindFunction(cell address) const {
+  // Functions don't overlap, so only those that start where the last one
+  // starting at or before the address does can contain it.
+  std::vector<const AMX_DBG_SYMBOL*>::const_iterator last =
+    std::upper_bound(function_index_.begin(), function_index_.end(), address,
+                     AddressLessThanCodeStart);
+  if (last == function_index_.begin()) {
+    return -1;
+  }
+  std::vector<const AMX_DBG_SYMBOL*>::const_iterator it =
+    std::lower_bound(function_index_.begin(), last, (*(last - 1))->codestart,
+                     CodeStartLessThanAddress);
+  for (; it != last; ++it) {
+    if (static_cast<cell>((*it)->codeend) > address) {
+      return static_cast<int>(it - function_index_.begin());
     }
   }
-  return file;
+  return -1;
 }
 
-static bool IsBuggedForward(const AMX_DBG_SYMBOL *symbol) {
-  // There seems to be a bug in Pawn compiler 3.2.3664 that adds
-  // forwarded publics to symbol table even if they are not implemented.
-  // Luckily it "works" only for those publics that start with '@'.
-  return (symbol->name[0] == '@');
+AMXDebugSymbol AMXDebugInfo::GetVariable(const std::string &name,
+                                         cell address) const {
+  const AMX_DBG_SYMBOL *variable = 0;
+
+  int function = FindFunction(address);
+  if (function >= 0) {
+    const std::vector<const AMX_DBG_SYMBOL*> &scope =
+      function_scopes_[function];
+    for (std::size_t i = 0; i < scope.size(); i++) {
+      if (name == scope[i]->name
+          && IsInScope(scope[i], address)
+          && IsInnerScope(scope[i], variable)) {
+        variable = scope[i];
+      }
+    }
+    if (variable != 0) {
+      return Symbol(variable);
+    }
+  }
+
+  typedef std::unordered_multimap<std::string_view,
+                                  const AMX_DBG_SYMBOL*>::const_iterator
+          GlobalIterator;
+  std::pair<GlobalIterator, GlobalIterator> range = globals_.equal_range(name);
+  for (GlobalIterator it = range.first; it != range.second; ++it) {
+    if (IsInScope(it->second, address) && IsInnerScope(it->second, variable)) {
+      variable = it->second;
+    }
+  }
+  return Symbol(variable);
 }
 
-AMXDebugSymbol AMXDebugInfo::GetFunction(cell address) const {
-  Symbol function;
-  SymbolTable symbols = GetSymbols();
-  for (SymbolTable::const_iterator it = symbols.begin();
-       it != symbols.end(); ++it) {
-    if (!it->IsFunction())
-      continue;
-    if (it->GetCodeStart() > address || it->GetCodeEnd() <= address)
-      continue;
-    if (IsBuggedForward(it->GetPOD())) 
-      continue;
-    function = *it;
-    break;
+bool AMXDebugInfo::GetLineRange(cell address, cell &start, cell &end) const {
+  std::vector<AMX_DBG_LINE>::const_iterator it =
+    std::upper_bound(line_index_.begin(), line_index_.end(), address,
+                     AddressLessThanLine);
+  if (it == line_index_.begin()) {
+    return false;
+  }
+  end = (it != line_index_.end()) ? static_cast<cell>(it->address)
+                                  : std::numeric_limits<cell>::max();
+  start = (it - 1)->address;
+  return true;
+}
+
+bool AMXDebugInfo::IsLineStart(cell address) const {
+  std::vector<AMX_DBG_LINE>::const_iterator it =
+    std::lower_bound(line_index_.begin(), line_index_.end(), address,
+                     LineLessThanAddress);
+  return it != line_index_.end() && static_cast<cell>(it->address) == address;
+}
+
+AMXDebugLine AMXDebugInfo::GetLine(cell address) const {
+  // Last line that starts at or before the address.
+  std::vector<AMX_DBG_LINE>::const_iterator it =
+    std::upper_bound(line_index_.begin(), line_index_.end(), address,
+                     AddressLessThanLine);
+  if (it == line_index_.begin()) {
+    return Line();
+  }
+  return Line(*(it - 1));
+}
+
+AMXDebugFile AMXDebugInfo::GetFile(cell address) const {
+  std::vector<const AMX_DBG_FILE*>::const_iterator it =
+    std::upper_bound(file_index_.begin(), file_index_.end(), address,
+                     AddressLessThanFile);
+  if (it == file_index_.begin()) {
+    return File();
   }
-  return function;
+  return File(*(it - 1));
+}
+
+AMXDebugSymbol AMXDebugInfo::GetFunction(cell address) const {
+  int function = FindFunction(address);
+  return function >= 0 ? Symbol(function_index_[function]) : Symbol();
 }
 
 AMXDebugSymbol AMXDebugInfo::GetExactFunction(cell address) const {
-  Symbol function;
-  SymbolTable symbols = GetSymbols();
-  for (SymbolTable::const_iterator it = symbols.begin();
-       it != symbols.end(); ++it) {
-    if (!it->IsFunction())
-      continue;
-    if (IsBuggedForward(it->GetPOD())) 
-      continue;
-    if (it->GetCodeStart() == address) {
-      function = *it;
-      break;
-    }
+  std::vector<const AMX_DBG_SYMBOL*>::const_iterator it =
+    std::lower_bound(function_index_.begin(), function_index_.end(), address,
+                     CodeStartLessThanAddress);
+  if (it == function_index_.end()
+      || static_cast<cell>((*it)->codestart) != address) {
+    return Symbol();
   }
-  return function;
+  return Symbol(*it);
 }
 
 AMXDebugTag AMXDebugInfo::GetTag(int32_t tag_id) const {
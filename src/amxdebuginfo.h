@@ -28,6 +28,8 @@
 #include <cassert>
 #include <iterator>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <amx/amx.h>
@@ -253,6 +255,18 @@ class AMXDebugInfo {
   Automaton GetAutomaton(cell address) const;
   State     GetState(int16_t automaton_id, int16_t state_id) const;
 
+  // Finds the address range [start, end) of the code generated for the line
+  // at the specified address. Returns false if the address precedes the
+  // first line.
+  bool GetLineRange(cell address, cell &start, cell &end) const;
+  bool IsLineStart(cell address) const;
+
+  // Finds the variable with the specified name that is visible at the
+  // specified address. Like dbg_GetVariable(), picks the one declared in
+  // the innermost scope, but only looks at the function containing the
+  // address and at variables declared outside of functions.
+  Symbol GetVariable(const std::string &name, cell address) const;
+
   int32_t     GetLineNumber(cell addrss) const;
   std::string GetFileName(cell address) const;
   std::string GetFunctionName(cell address) const;
@@ -297,8 +311,23 @@ class AMXDebugInfo {
   AMXDebugInfo(const AMXDebugInfo &);
   AMXDebugInfo &operator=(const AMXDebugInfo &);
 
+  void BuildIndexes();
+  int FindFunction(cell address) const;
+
  private:
   AMX_DBG *amxdbg_;
+
+  // Address lookups use these instead of the tables above. They are sorted
+  // by (start) address and built once on Load(); the function index only
+  // has real functions.
+  std::vector<AMX_DBG_LINE> line_index_;
+  std::vector<const AMX_DBG_FILE*> file_index_;
+  std::vector<const AMX_DBG_SYMBOL*> function_index_;
+
+  // Variables declared in each function of function_index_, and those
+  // declared outside of functions by name.
+  std::vector<std::vector<const AMX_DBG_SYMBOL*>> function_scopes_;
+  std::unordered_multimap<std::string_view, const AMX_DBG_SYMBOL*> globals_;
 };
 
 typedef AMXDebugInfo::File      AMXDebugFile;
@@ -1,14 +1,276 @@
+#include <algorithm>
 #include <cassert>
-#include <chrono> 
+#include <chrono>
+#include <cstring>
 #include <thread>
-#include <iostream>
 
+#include "amxcallprofiler.h"
+#include "amxdebuginfo.h"
 #include "amxexecutor.h"
 #include "amxopcode.h"
+#include "amxopcodecounter.h"
+#include "amxprofiler.h"
+#include "amxstacktrace.h"
 #include "log.h"
 
-AMXExecutor::AMXExecutor(AMX *amx) : AMXService<AMXExecutor>(amx)
-{}
+/* Superinstructions that don't exist in the AMX instruction set. They are
+ * numbered after the real opcodes and only ever appear in the decoded program.
+ */
+enum {
+  AMX_OP_LOAD_PRI_PUSH_PRI=NUM_AMX_OPCODES,
+  AMX_OP_LOAD_S_PRI_PUSH_PRI,
+  AMX_OP_ADDR_PRI_PUSH_PRI,
+  AMX_OP_CONST_PRI_PUSH_PRI,
+  AMX_OP_CONST_PRI_JZER,
+  NUM_EXEC_OPCODES
+};
+
+AMXExecutor::AMXExecutor(AMX *amx)
+ : AMXService<AMXExecutor>(amx),
+   flags_(EXEC_NONE),
+   throttle_delay_(0),
+   breakpoint_words_(0),
+   num_breakpoints_(0),
+   watchpoints_(0),
+   has_retired_watchpoints_(false),
+   watch_hit_(false),
+   watch_hit_address_(0),
+   watch_hit_instruction_(0),
+   has_backtrace_(false),
+   profiler_(0),
+   call_profiler_(0),
+   opcode_counter_(0)
+{
+  watchpoint_sets_.emplace_back(new IntervalSet);
+  watchpoints_ = watchpoint_sets_.back().get();
+}
+
+int AMXExecutor::Load() {
+  if (!program_.Decode(amx())) {
+    return AMX_ERR_INIT;
+  }
+  const AMX_HEADER *hdr = amx().GetHeader();
+  std::size_t num_cells = (hdr->dat - hdr->cod) / sizeof(cell);
+  breakpoint_words_ = (num_cells + 31) / 32;
+  breakpoints_.reset(new std::atomic<uint32_t>[breakpoint_words_]());
+  num_breakpoints_ = 0;
+  DisableFlags(EXEC_BREAKPOINTS);
+  return AMX_ERR_NONE;
+}
+
+bool AMXExecutor::SetBreakpoint(cell address) {
+  if (!program_.IsInstructionBoundary(address)
+      || address / sizeof(cell) >= breakpoint_words_ * 32) {
+    return false;
+  }
+  // No need to unfuse anything: while EXEC_BREAKPOINTS is set every
+  // instruction goes through the hook, which runs original instructions
+  // rather than superinstructions.
+  std::size_t index = address / sizeof(cell);
+  uint32_t bit = 1u << (index % 32);
+  uint32_t old = breakpoints_[index / 32].fetch_or(bit);
+  if ((old & bit) == 0 && num_breakpoints_++ == 0) {
+    EnableFlags(EXEC_BREAKPOINTS);
+  }
+  return true;
+}
+
+bool AMXExecutor::RemoveBreakpoint(cell address) {
+  if (address < 0 || address / sizeof(cell) >= breakpoint_words_ * 32) {
+    return false;
+  }
+  std::size_t index = address / sizeof(cell);
+  uint32_t bit = 1u << (index % 32);
+  uint32_t old = breakpoints_[index / 32].fetch_and(~bit);
+  if ((old & bit) == 0) {
+    return false;
+  }
+  if (--num_breakpoints_ == 0) {
+    DisableFlags(EXEC_BREAKPOINTS);
+  }
+  return true;
+}
+
+void AMXExecutor::RemoveAllBreakpoints() {
+  for (std::size_t i = 0; i < breakpoint_words_; i++) {
+    uint32_t old = breakpoints_[i].exchange(0);
+    for (; old != 0; old &= old - 1) {
+      if (--num_breakpoints_ == 0) {
+        DisableFlags(EXEC_BREAKPOINTS);
+      }
+    }
+  }
+}
+
+bool AMXExecutor::AddWatchpoint(cell address, cell size) {
+  if (address < 0 || size <= 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(watchpoints_mutex_);
+  watchpoint_ranges_.push_back(std::make_pair(address, address + size));
+  UpdateWatchpoints();
+  return true;
+}
+
+bool AMXExecutor::RemoveWatchpoint(cell address, cell size) {
+  std::lock_guard<std::mutex> lock(watchpoints_mutex_);
+  std::vector<std::pair<cell, cell>>::iterator iterator =
+    std::find(watchpoint_ranges_.begin(), watchpoint_ranges_.end(),
+              std::make_pair(address, address + size));
+  if (iterator == watchpoint_ranges_.end()) {
+    return false;
+  }
+  watchpoint_ranges_.erase(iterator);
+  UpdateWatchpoints();
+  return true;
+}
+
+void AMXExecutor::RemoveAllWatchpoints() {
+  std::lock_guard<std::mutex> lock(watchpoints_mutex_);
+  watchpoint_ranges_.clear();
+  UpdateWatchpoints();
+}
+
+void AMXExecutor::UpdateWatchpoints() {
+  watchpoint_sets_.emplace_back(new IntervalSet(watchpoint_ranges_));
+  watchpoints_.store(watchpoint_sets_.back().get(), std::memory_order_release);
+  has_retired_watchpoints_.store(true, std::memory_order_relaxed);
+  if (watchpoint_ranges_.empty()) {
+    DisableFlags(EXEC_WATCHPOINTS);
+  } else {
+    EnableFlags(EXEC_WATCHPOINTS);
+  }
+}
+
+void AMXExecutor::FreeRetiredWatchpoints() {
+  // Called on the script thread. Never wait for the network thread here; if
+  // it's busy changing the watchpoints, try next time.
+  std::unique_lock<std::mutex> lock(watchpoints_mutex_, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return;
+  }
+  watchpoint_sets_.erase(watchpoint_sets_.begin(),
+                         watchpoint_sets_.end() - 1);
+  has_retired_watchpoints_.store(false, std::memory_order_relaxed);
+}
+
+bool AMXExecutor::TakeWatchpointHit(cell &address, cell &instruction) {
+  if (!watch_hit_) {
+    return false;
+  }
+  watch_hit_ = false;
+  address = watch_hit_address_;
+  instruction = watch_hit_instruction_;
+  return true;
+}
+
+bool AMXExecutor::TakeBacktrace(std::vector<cell> &frames) {
+  if (!has_backtrace_) {
+    return false;
+  }
+  has_backtrace_ = false;
+  frames.swap(backtrace_);
+  return true;
+}
+
+void AMXExecutor::RecordBacktrace(cell cip) {
+  // Same walk as the profiler's: the first frame returns to cip, so every
+  // address is a location in the function it belongs to.
+  const int kMaxFrames = 32;
+  backtrace_.clear();
+  AMXStackTrace trace = GetAMXStackTrace(amx(), amx().GetFrm(), cip, kMaxFrames);
+  while (trace.current_frame().return_address() != 0) {
+    backtrace_.push_back(trace.current_frame().return_address());
+    if (!trace.MoveNext()) {
+      break;
+    }
+  }
+  has_backtrace_ = true;
+}
+
+namespace {
+
+// Pairs of instructions that are fused into one superinstruction.
+const struct {
+  AMXOpcode first;
+  AMXOpcode second;
+  int fused;
+} kFusedPairs[] = {
+  {AMX_OP_LOAD_PRI,   AMX_OP_LOAD_ALT,   AMX_OP_LOAD_BOTH},
+  {AMX_OP_LOAD_S_PRI, AMX_OP_LOAD_S_ALT, AMX_OP_LOAD_S_BOTH},
+  {AMX_OP_LOAD_PRI,   AMX_OP_PUSH_PRI,   AMX_OP_LOAD_PRI_PUSH_PRI},
+  {AMX_OP_LOAD_S_PRI, AMX_OP_PUSH_PRI,   AMX_OP_LOAD_S_PRI_PUSH_PRI},
+  {AMX_OP_ADDR_PRI,   AMX_OP_PUSH_PRI,   AMX_OP_ADDR_PRI_PUSH_PRI},
+  {AMX_OP_CONST_PRI,  AMX_OP_PUSH_PRI,   AMX_OP_CONST_PRI_PUSH_PRI},
+  {AMX_OP_CONST_PRI,  AMX_OP_JZER,       AMX_OP_CONST_PRI_JZER}
+};
+
+// Runs of 2 to 5 pushes of the same kind (typically function arguments).
+const int kMaxFusedPushes = 5;
+const struct {
+  AMXOpcode push;
+  int fused[kMaxFusedPushes - 1];
+} kFusedPushes[] = {
+  {AMX_OP_PUSH_C,
+   {AMX_OP_PUSH2_C, AMX_OP_PUSH3_C, AMX_OP_PUSH4_C, AMX_OP_PUSH5_C}},
+  {AMX_OP_PUSH,
+   {AMX_OP_PUSH2, AMX_OP_PUSH3, AMX_OP_PUSH4, AMX_OP_PUSH5}},
+  {AMX_OP_PUSH_S,
+   {AMX_OP_PUSH2_S, AMX_OP_PUSH3_S, AMX_OP_PUSH4_S, AMX_OP_PUSH5_S}},
+  {AMX_OP_PUSH_ADR,
+   {AMX_OP_PUSH2_ADR, AMX_OP_PUSH3_ADR, AMX_OP_PUSH4_ADR, AMX_OP_PUSH5_ADR}}
+};
+
+} // anonymous namespace
+
+int AMXExecutor::FuseInstructions() {
+  const cell *opcode_table = GetOpcodeTable();
+  int num_fused = 0;
+
+  for (AMXInstruction *instr = program_.begin(); instr != program_.end(); ) {
+    AMXOpcode opcode = program_.GetOpcode(instr);
+    AMXOpcode next = program_.GetOpcode(instr + 1);
+    int length = 1;
+    int fused = AMX_OP_NONE;
+
+    for (std::size_t i = 0; i < sizeof(kFusedPushes) / sizeof(kFusedPushes[0]);
+         i++) {
+      if (opcode == kFusedPushes[i].push) {
+        while (length < kMaxFusedPushes
+               && program_.GetOpcode(instr + length) == opcode) {
+          length++;
+        }
+        if (length > 1) {
+          fused = kFusedPushes[i].fused[length - 2];
+        }
+        break;
+      }
+    }
+    if (fused == AMX_OP_NONE) {
+      length = 1;
+      for (std::size_t i = 0; i < sizeof(kFusedPairs) / sizeof(kFusedPairs[0]);
+           i++) {
+        if (opcode == kFusedPairs[i].first && next == kFusedPairs[i].second) {
+          fused = kFusedPairs[i].fused;
+          length = 2;
+          break;
+        }
+      }
+    }
+
+    if (fused != AMX_OP_NONE) {
+      program_.Fuse(instr, length, opcode_table[fused]);
+      num_fused++;
+    }
+    instr += length;
+  }
+
+  return num_fused;
+}
+
+void AMXExecutor::UnfuseInstructions() {
+  program_.UnfuseAll();
+}
 
 #if !defined _R
   #define _R_DEFAULT            /* mark default memory access */
@@ -30,14 +292,16 @@ AMXExecutor::AMXExecutor(AMX *amx) : AMXService<AMXExecutor>(amx)
 #define GETENTRY(hdr,table,index) \
                         (AMX_FUNCSTUB *)((unsigned char*)(hdr) + (unsigned)(hdr)->table + (unsigned)index*(hdr)->defsize)
 
-#if !defined _RCODE
-  #define _RCODE()      ( *cip++ )
-#endif
+/* cip always points to the next instruction, so the one being executed is
+ * cip[-1]
+ */
+#define GETPARAM(v)     ( v=cip[-1].operand )
+#define JUMPTARGET()    ( cip[-1].target )
 
-#if !defined GETPARAM
-  #define GETPARAM(v)   ( v=_RCODE() )   /* read a parameter from the opcode stream */
-#endif
-#define SKIPPARAM(n)    ( cip=(cell *)cip+(n) ) /* for obsolete opcodes */
+/* for superinstructions: n is the position in the fused sequence */
+#define GETPARAM_P(v,n) ( v=cip[(n)-1].operand )
+#define JUMPTARGET_P(n) ( cip[(n)-1].target )
+#define SKIPINSN(n)     ( cip+=(n) )
 
 #define PUSH(v)         ( stk-=sizeof(cell), _W(data,stk,v) )
 #define POP(v)          ( v=_R(data,stk), stk+=sizeof(cell) )
@@ -50,25 +314,113 @@ AMXExecutor::AMXExecutor(AMX *amx) : AMXService<AMXExecutor>(amx)
 
 #define STKMARGIN       ((cell)(16*sizeof(cell)))
 
-#define JUMPABS(base, ip)     ((cell *)*(ip))
-#define RELOC_ABS(base, off)  (*(ucell *)((base)+(int)(off)) += (ucell)(base))
-#define RELOC_VALUE(base, v)  ((v)+((ucell)(base)))
+/* The interpreter runs the pre-decoded copy of the code (see AMXProgram),
+ * whose handler fields are taken from the code as relocated by amx_Init().
+ * GCC and Clang get a direct-threaded interpreter: the code is relocated with
+ * our handler addresses (see GetOpcodeTable) and every handler jumps straight
+ * to the next one. Everything else uses a plain switch on opcode numbers,
+ * which is also what amx_Init() leaves in the code on those builds.
+ */
+#if defined __GNUC__ && !defined __MINGW32__ && !defined AMX_NO_THREADED_DISPATCH
+  #define AMX_THREADED_DISPATCH
+#endif
+
+#if defined AMX_THREADED_DISPATCH
+  #define OPCODE(name)  op_##name
+  #define NEXT()        do { if (flags_.load(std::memory_order_relaxed)!=EXEC_NONE) \
+                               goto hook; \
+                             goto *(void *)(cip++)->handler; } while (0)
+#else
+  #define OPCODE(name)  case AMX_OP_##name
+  #define NEXT()        goto next
+#endif
 
 int AMXExecutor::HandleAMXExec(cell *retval, int index) {
   AMX *_amx = amx();
   AMX_HEADER *hdr;
   AMX_FUNCSTUB *func;
-  unsigned char *code, *data;
+  AMXInstruction *cip;
+  unsigned char *data;
   cell pri,alt,stk,frm,hea;
-  cell reset_stk, reset_hea, *cip;
-  ucell codesize;
+  cell reset_stk, reset_hea;
   int i;
 
-  AMXOpcode op;
   cell offs,val;
-  int num;
+  int num,flags;
+  uint64_t ticks=0;
+  #if defined AMX_THREADED_DISPATCH
+    static const void *const handlers[] = {
+      &&op_invalid, &&op_LOAD_PRI, &&op_LOAD_ALT,
+      &&op_LOAD_S_PRI, &&op_LOAD_S_ALT, &&op_LREF_PRI,
+      &&op_LREF_ALT, &&op_LREF_S_PRI, &&op_LREF_S_ALT,
+      &&op_LOAD_I, &&op_LODB_I, &&op_CONST_PRI,
+      &&op_CONST_ALT, &&op_ADDR_PRI, &&op_ADDR_ALT,
+      &&op_STOR_PRI, &&op_STOR_ALT, &&op_STOR_S_PRI,
+      &&op_STOR_S_ALT, &&op_SREF_PRI, &&op_SREF_ALT,
+      &&op_SREF_S_PRI, &&op_SREF_S_ALT, &&op_STOR_I,
+      &&op_STRB_I, &&op_LIDX, &&op_LIDX_B,
+      &&op_IDXADDR, &&op_IDXADDR_B, &&op_ALIGN_PRI,
+      &&op_ALIGN_ALT, &&op_LCTRL, &&op_SCTRL,
+      &&op_MOVE_PRI, &&op_MOVE_ALT, &&op_XCHG,
+      &&op_PUSH_PRI, &&op_PUSH_ALT, &&op_PUSH_R,
+      &&op_PUSH_C, &&op_PUSH, &&op_PUSH_S,
+      &&op_PAMX_OP_PRI, &&op_PAMX_OP_ALT, &&op_STACK,
+      &&op_HEAP, &&op_PROC, &&op_RET,
+      &&op_RETN, &&op_CALL, &&op_CALL_PRI,
+      &&op_JUMP, &&op_JREL, &&op_JZER,
+      &&op_JNZ, &&op_JEQ, &&op_JNEQ,
+      &&op_JLESS, &&op_JLEQ, &&op_JGRTR,
+      &&op_JGEQ, &&op_JSLESS, &&op_JSLEQ,
+      &&op_JSGRTR, &&op_JSGEQ, &&op_SHL,
+      &&op_SHR, &&op_SSHR, &&op_SHL_C_PRI,
+      &&op_SHL_C_ALT, &&op_SHR_C_PRI, &&op_SHR_C_ALT,
+      &&op_SMUL, &&op_SDIV, &&op_SDIV_ALT,
+      &&op_UMUL, &&op_UDIV, &&op_UDIV_ALT,
+      &&op_ADD, &&op_SUB, &&op_SUB_ALT,
+      &&op_AND, &&op_OR, &&op_XOR,
+      &&op_NOT, &&op_NEG, &&op_INVERT,
+      &&op_ADD_C, &&op_SMUL_C, &&op_ZERO_PRI,
+      &&op_ZERO_ALT, &&op_ZERO, &&op_ZERO_S,
+      &&op_SIGN_PRI, &&op_SIGN_ALT, &&op_EQ,
+      &&op_NEQ, &&op_LESS, &&op_LEQ,
+      &&op_GRTR, &&op_GEQ, &&op_SLESS,
+      &&op_SLEQ, &&op_SGRTR, &&op_SGEQ,
+      &&op_EQ_C_PRI, &&op_EQ_C_ALT, &&op_INC_PRI,
+      &&op_INC_ALT, &&op_INC, &&op_INC_S,
+      &&op_INC_I, &&op_DEC_PRI, &&op_DEC_ALT,
+      &&op_DEC, &&op_DEC_S, &&op_DEC_I,
+      &&op_MOVS, &&op_CMPS, &&op_FILL,
+      &&op_HALT, &&op_BOUNDS, &&op_SYSREQ_PRI,
+      &&op_SYSREQ_C, &&op_invalid, &&op_LINE,
+      &&op_SYMBOL, &&op_SRANGE, &&op_JUMP_PRI,
+      &&op_SWITCH, &&op_invalid, &&op_SWAP_PRI,
+      &&op_SWAP_ALT, &&op_PUSH_ADR, &&op_NOP,
+      &&op_invalid, &&op_SYMTAG, &&op_BREAK,
+      &&op_PUSH2_C, &&op_PUSH2, &&op_PUSH2_S,
+      &&op_PUSH2_ADR, &&op_PUSH3_C, &&op_PUSH3,
+      &&op_PUSH3_S, &&op_PUSH3_ADR, &&op_PUSH4_C,
+      &&op_PUSH4, &&op_PUSH4_S, &&op_PUSH4_ADR,
+      &&op_PUSH5_C, &&op_PUSH5, &&op_PUSH5_S,
+      &&op_PUSH5_ADR, &&op_LOAD_BOTH, &&op_LOAD_S_BOTH,
+      &&op_invalid, &&op_invalid, &&op_invalid,
+      &&op_invalid, &&op_LOAD_PRI_PUSH_PRI, &&op_LOAD_S_PRI_PUSH_PRI,
+      &&op_ADDR_PRI_PUSH_PRI, &&op_CONST_PRI_PUSH_PRI, &&op_CONST_PRI_JZER
+    };
+    static_assert(sizeof(handlers)/sizeof(handlers[0])==NUM_EXEC_OPCODES);
+  #else
+    cell op;
+  #endif
 
   assert(_amx!=NULL);
+  #if defined AMX_THREADED_DISPATCH
+    /* return the handler table (for GetOpcodeTable) */
+    if ((_amx->flags & AMX_FLAG_BROWSE)==AMX_FLAG_BROWSE) {
+      static_assert(sizeof(cell)==sizeof(void *));
+      assert(retval!=NULL);
+      *retval=(cell)handlers;
+      return AMX_ERR_NONE;
+    } /* if */
+  #endif
 
   if (_amx->callback==NULL)
     return AMX_ERR_CALLBACK;
@@ -79,12 +431,13 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
       return i;
   } /* if */
   assert((_amx->flags & AMX_FLAG_BROWSE)==0);
+  if (program_.IsEmpty() && Load()!=AMX_ERR_NONE)
+    return AMX_ERR_INIT;
+  watch_hit_=false;
 
   /* set up the registers */
   hdr=(AMX_HEADER *)_amx->base;
   assert(hdr->magic==AMX_MAGIC);
-  codesize=(ucell)(hdr->dat-hdr->cod);
-  code=_amx->base+(int)hdr->cod;
   data=(_amx->data!=NULL) ? _amx->data : _amx->base+(int)hdr->dat;
   hea=_amx->hea;
   stk=_amx->stk;
@@ -96,7 +449,7 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
   if (index==AMX_EXEC_MAIN) {
     if (hdr->cip<0)
       return AMX_ERR_INDEX;
-    cip=(cell *)(code + (int)hdr->cip);
+    cip=program_.Find(hdr->cip);
   } else if (index==AMX_EXEC_CONT) {
     /* all registers: pri, alt, frm, cip, hea, stk, reset_stk, reset_hea */
     frm=_amx->frm;
@@ -106,15 +459,17 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
     alt=_amx->alt;
     reset_stk=_amx->reset_stk;
     reset_hea=_amx->reset_hea;
-    cip=(cell *)(code + (int)_amx->cip);
+    cip=program_.Find(_amx->cip);
   } else if (index<0) {
     return AMX_ERR_INDEX;
   } else {
     if (index>=(cell)NUMENTRIES(hdr,publics,natives))
       return AMX_ERR_INDEX;
     func=GETENTRY(hdr,publics,index);
-    cip=(cell *)(code + (int)func->address);
+    cip=program_.Find(func->address);
   } /* if */
+  if (cip==NULL)
+    return AMX_ERR_MEMACCESS;
   /* check values just copied */
   CHKSTACK();
   CHKHEAP();
@@ -140,59 +495,64 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
   } /* if */
   /* check stack/heap before starting to run */
   CHKMARGIN();
+  /* a sample asked for while the script wasn't running is stale */
+  if ((flags_.load(std::memory_order_relaxed) & EXEC_SAMPLE)!=0)
+    DisableFlags(EXEC_SAMPLE);
 
-  for ( ;; ) {
-    LogDebugPrint("Current CIP: %d | Current OP: %s | Param or next OP: %d",
-      (uint32_t) ((unsigned char *) cip - code),
-      std::string(AMXOpcodeNames[*cip]).c_str(),
-      *(cip + 1)
-    );
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    op=(AMXOpcode) _RCODE();
-    switch (op) {
-    case AMX_OP_LOAD_PRI:
+  /* start the interpreter */
+  NEXT();
+
+#if !defined AMX_THREADED_DISPATCH
+next:
+  if (flags_.load(std::memory_order_relaxed)!=EXEC_NONE)
+    goto hook;
+  op=(cip++)->handler;
+dispatch:
+  switch (op) {
+#endif
+    OPCODE(LOAD_PRI):
       GETPARAM(offs);
       pri=_R(data,offs);
-      break;
-    case AMX_OP_LOAD_ALT:
+      NEXT();
+    OPCODE(LOAD_ALT):
       GETPARAM(offs);
       alt=_R(data,offs);
-      break;
-    case AMX_OP_LOAD_S_PRI:
+      NEXT();
+    OPCODE(LOAD_S_PRI):
       GETPARAM(offs);
       pri=_R(data,frm+offs);
-      break;
-    case AMX_OP_LOAD_S_ALT:
+      NEXT();
+    OPCODE(LOAD_S_ALT):
       GETPARAM(offs);
       alt=_R(data,frm+offs);
-      break;
-    case AMX_OP_LREF_PRI:
+      NEXT();
+    OPCODE(LREF_PRI):
       GETPARAM(offs);
       offs=_R(data,offs);
       pri=_R(data,offs);
-      break;
-    case AMX_OP_LREF_ALT:
+      NEXT();
+    OPCODE(LREF_ALT):
       GETPARAM(offs);
       offs=_R(data,offs);
       alt=_R(data,offs);
-      break;
-    case AMX_OP_LREF_S_PRI:
+      NEXT();
+    OPCODE(LREF_S_PRI):
       GETPARAM(offs);
       offs=_R(data,frm+offs);
       pri=_R(data,offs);
-      break;
-    case AMX_OP_LREF_S_ALT:
+      NEXT();
+    OPCODE(LREF_S_ALT):
       GETPARAM(offs);
       offs=_R(data,frm+offs);
       alt=_R(data,offs);
-      break;
-    case AMX_OP_LOAD_I:
+      NEXT();
+    OPCODE(LOAD_I):
       /* verify address */
       if (pri>=hea && pri<stk || (ucell)pri>=(ucell)_amx->stp)
         ABORT(_amx,AMX_ERR_MEMACCESS);
       pri=_R(data,pri);
-      break;
-    case AMX_OP_LODB_I:
+      NEXT();
+    OPCODE(LODB_I):
       GETPARAM(offs);
       /* verify address */
       if (pri>=hea && pri<stk || (ucell)pri>=(ucell)_amx->stp)
@@ -208,64 +568,64 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         pri=_R32(data,pri);
         break;
       } /* switch */
-      break;
-    case AMX_OP_CONST_PRI:
+      NEXT();
+    OPCODE(CONST_PRI):
       GETPARAM(pri);
-      break;
-    case AMX_OP_CONST_ALT:
+      NEXT();
+    OPCODE(CONST_ALT):
       GETPARAM(alt);
-      break;
-    case AMX_OP_ADDR_PRI:
+      NEXT();
+    OPCODE(ADDR_PRI):
       GETPARAM(pri);
       pri+=frm;
-      break;
-    case AMX_OP_ADDR_ALT:
+      NEXT();
+    OPCODE(ADDR_ALT):
       GETPARAM(alt);
       alt+=frm;
-      break;
-    case AMX_OP_STOR_PRI:
+      NEXT();
+    OPCODE(STOR_PRI):
       GETPARAM(offs);
       _W(data,offs,pri);
-      break;
-    case AMX_OP_STOR_ALT:
+      NEXT();
+    OPCODE(STOR_ALT):
       GETPARAM(offs);
       _W(data,offs,alt);
-      break;
-    case AMX_OP_STOR_S_PRI:
+      NEXT();
+    OPCODE(STOR_S_PRI):
       GETPARAM(offs);
       _W(data,frm+offs,pri);
-      break;
-    case AMX_OP_STOR_S_ALT:
+      NEXT();
+    OPCODE(STOR_S_ALT):
       GETPARAM(offs);
       _W(data,frm+offs,alt);
-      break;
-    case AMX_OP_SREF_PRI:
+      NEXT();
+    OPCODE(SREF_PRI):
       GETPARAM(offs);
       offs=_R(data,offs);
       _W(data,offs,pri);
-      break;
-    case AMX_OP_SREF_ALT:
+      NEXT();
+    OPCODE(SREF_ALT):
       GETPARAM(offs);
       offs=_R(data,offs);
       _W(data,offs,alt);
-      break;
-    case AMX_OP_SREF_S_PRI:
+      NEXT();
+    OPCODE(SREF_S_PRI):
       GETPARAM(offs);
       offs=_R(data,frm+offs);
       _W(data,offs,pri);
-      break;
-    case AMX_OP_SREF_S_ALT:
+      NEXT();
+    OPCODE(SREF_S_ALT):
       GETPARAM(offs);
       offs=_R(data,frm+offs);
       _W(data,offs,alt);
-      break;
-    case AMX_OP_STOR_I:
+      NEXT();
+    OPCODE(STOR_I):
       /* verify address */
       if (alt>=hea && alt<stk || (ucell)alt>=(ucell)_amx->stp)
         ABORT(_amx,AMX_ERR_MEMACCESS);
       _W(data,alt,pri);
-      break;
-    case AMX_OP_STRB_I:
+      NEXT();
+    OPCODE(STRB_I):
       GETPARAM(offs);
       /* verify address */
       if (alt>=hea && alt<stk || (ucell)alt>=(ucell)_amx->stp)
@@ -281,40 +641,40 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         _W32(data,alt,pri);
         break;
       } /* switch */
-      break;
-    case AMX_OP_LIDX:
+      NEXT();
+    OPCODE(LIDX):
       offs=pri*sizeof(cell)+alt;
       /* verify address */
       if (offs>=hea && offs<stk || (ucell)offs>=(ucell)_amx->stp)
         ABORT(_amx,AMX_ERR_MEMACCESS);
       pri=_R(data,offs);
-      break;
-    case AMX_OP_LIDX_B:
+      NEXT();
+    OPCODE(LIDX_B):
       GETPARAM(offs);
       offs=(pri << (int)offs)+alt;
       /* verify address */
       if (offs>=hea && offs<stk || (ucell)offs>=(ucell)_amx->stp)
         ABORT(_amx,AMX_ERR_MEMACCESS);
       pri=_R(data,offs);
-      break;
-    case AMX_OP_IDXADDR:
+      NEXT();
+    OPCODE(IDXADDR):
       pri=pri*sizeof(cell)+alt;
-      break;
-    case AMX_OP_IDXADDR_B:
+      NEXT();
+    OPCODE(IDXADDR_B):
       GETPARAM(offs);
       pri=(pri << (int)offs)+alt;
-      break;
-    case AMX_OP_ALIGN_PRI:
+      NEXT();
+    OPCODE(ALIGN_PRI):
       GETPARAM(offs);
       if ((size_t)offs<sizeof(cell))
         pri ^= sizeof(cell)-offs;
-      break;
-    case AMX_OP_ALIGN_ALT:
+      NEXT();
+    OPCODE(ALIGN_ALT):
       GETPARAM(offs);
       if ((size_t)offs<sizeof(cell))
         alt ^= sizeof(cell)-offs;
-      break;
-    case AMX_OP_LCTRL:
+      NEXT();
+    OPCODE(LCTRL):
       GETPARAM(offs);
       switch ((int)offs) {
       case 0:
@@ -336,11 +696,11 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         pri=frm;
         break;
       case 6:
-        pri=(cell)((unsigned char *)cip - code);
+        pri=cip->address;
         break;
       } /* switch */
-      break;
-    case AMX_OP_SCTRL:
+      NEXT();
+    OPCODE(SCTRL):
       GETPARAM(offs);
       switch ((int)offs) {
       case 0:
@@ -358,205 +718,188 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         frm=pri;
         break;
       case 6:
-        cip=(cell *)(code + (int)pri);
+        cip=program_.Find(pri);
+        if (cip==NULL)
+          ABORT(_amx,AMX_ERR_MEMACCESS);
         break;
       } /* switch */
-      break;
-    case AMX_OP_MOVE_PRI:
+      NEXT();
+    OPCODE(MOVE_PRI):
       pri=alt;
-      break;
-    case AMX_OP_MOVE_ALT:
+      NEXT();
+    OPCODE(MOVE_ALT):
       alt=pri;
-      break;
-    case AMX_OP_XCHG:
+      NEXT();
+    OPCODE(XCHG):
       offs=pri;         /* offs is a temporary variable */
       pri=alt;
       alt=offs;
-      break;
-    case AMX_OP_PUSH_PRI:
+      NEXT();
+    OPCODE(PUSH_PRI):
       PUSH(pri);
-      break;
-    case AMX_OP_PUSH_ALT:
+      NEXT();
+    OPCODE(PUSH_ALT):
       PUSH(alt);
-      break;
-    case AMX_OP_PUSH_C:
+      NEXT();
+    OPCODE(PUSH_C):
       GETPARAM(offs);
       PUSH(offs);
-      break;
-    case AMX_OP_PUSH_R:
+      NEXT();
+    OPCODE(PUSH_R):
       GETPARAM(offs);
       while (offs--)
         PUSH(pri);
-      break;
-    case AMX_OP_PUSH:
+      NEXT();
+    OPCODE(PUSH):
       GETPARAM(offs);
       PUSH(_R(data,offs));
-      break;
-    case AMX_OP_PUSH_S:
+      NEXT();
+    OPCODE(PUSH_S):
       GETPARAM(offs);
       PUSH(_R(data,frm+offs));
-      break;
-    case AMX_OP_PAMX_OP_PRI:
+      NEXT();
+    OPCODE(PAMX_OP_PRI):
       POP(pri);
-      break;
-    case AMX_OP_PAMX_OP_ALT:
+      NEXT();
+    OPCODE(PAMX_OP_ALT):
       POP(alt);
-      break;
-    case AMX_OP_STACK:
+      NEXT();
+    OPCODE(STACK):
       GETPARAM(offs);
       alt=stk;
       stk+=offs;
       CHKMARGIN();
       CHKSTACK();
-      break;
-    case AMX_OP_HEAP:
+      NEXT();
+    OPCODE(HEAP):
       GETPARAM(offs);
       alt=hea;
       hea+=offs;
       CHKMARGIN();
       CHKHEAP();
-      break;
-    case AMX_OP_PROC:
+      NEXT();
+    OPCODE(PROC):
       PUSH(frm);
       frm=stk;
       CHKMARGIN();
-      break;
-    case AMX_OP_RET:
+      if (call_profiler_!=NULL)
+        call_profiler_->Enter(cip-1,frm,_R(data,frm+sizeof(cell)));
+      NEXT();
+    OPCODE(RET):
+      if (call_profiler_!=NULL)
+        call_profiler_->Exit(frm);
       POP(frm);
       POP(offs);
       /* verify the return address */
-      if ((ucell)offs>=codesize)
+      cip=program_.Find(offs);
+      if (cip==NULL)
         ABORT(_amx,AMX_ERR_MEMACCESS);
-      cip=(cell *)(code+(int)offs);
-      break;
-    case AMX_OP_RETN:
+      NEXT();
+    OPCODE(RETN):
+      if (call_profiler_!=NULL)
+        call_profiler_->Exit(frm);
       POP(frm);
       POP(offs);
       /* verify the return address */
-      if ((ucell)offs>=codesize)
+      cip=program_.Find(offs);
+      if (cip==NULL)
         ABORT(_amx,AMX_ERR_MEMACCESS);
-      cip=(cell *)(code+(int)offs);
       stk+=_R(data,stk)+sizeof(cell);   /* remove parameters from the stack */
       _amx->stk=stk;
-      break;
-    case AMX_OP_CALL:
-      PUSH(((unsigned char *)cip-code)+sizeof(cell));/* skip address */
-      cip=JUMPABS(code, cip);                   /* jump to the address */
-      break;
-    case AMX_OP_CALL_PRI:
-      PUSH((unsigned char *)cip-code);
-      cip=(cell *)(code+(int)pri);
-      break;
-    case AMX_OP_JUMP:
-      /* since the GETPARAM() macro modifies cip, you cannot
-       * do GETPARAM(cip) directly */
-      cip=JUMPABS(code, cip);
-      break;
-    case AMX_OP_JREL:
-      offs=*cip;
-      cip=(cell *)((unsigned char *)cip + (int)offs + sizeof(cell));
-      break;
-    case AMX_OP_JZER:
+      NEXT();
+    OPCODE(CALL):
+      PUSH(cip->address);
+      cip=JUMPTARGET();
+      NEXT();
+    OPCODE(CALL_PRI):
+      PUSH(cip->address);
+      cip=program_.Find(pri);
+      if (cip==NULL)
+        ABORT(_amx,AMX_ERR_MEMACCESS);
+      NEXT();
+    OPCODE(JUMP):
+      cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JREL):
+      cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JZER):
       if (pri==0)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_JNZ:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JNZ):
       if (pri!=0)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_JEQ:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JEQ):
       if (pri==alt)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_JNEQ:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JNEQ):
       if (pri!=alt)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_JLESS:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JLESS):
       if ((ucell)pri < (ucell)alt)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_JLEQ:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JLEQ):
       if ((ucell)pri <= (ucell)alt)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_JGRTR:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JGRTR):
       if ((ucell)pri > (ucell)alt)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_JGEQ:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JGEQ):
       if ((ucell)pri >= (ucell)alt)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_JSLESS:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JSLESS):
       if (pri<alt)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_JSLEQ:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JSLEQ):
       if (pri<=alt)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_JSGRTR:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JSGRTR):
       if (pri>alt)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_JSGEQ:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(JSGEQ):
       if (pri>=alt)
-        cip=JUMPABS(code, cip);
-      else
-        cip=(cell *)((unsigned char *)cip+sizeof(cell));
-      break;
-    case AMX_OP_SHL:
+        cip=JUMPTARGET();
+      NEXT();
+    OPCODE(SHL):
       pri<<=alt;
-      break;
-    case AMX_OP_SHR:
+      NEXT();
+    OPCODE(SHR):
       pri=(ucell)pri >> (int)alt;
-      break;
-    case AMX_OP_SSHR:
+      NEXT();
+    OPCODE(SSHR):
       pri>>=alt;
-      break;
-    case AMX_OP_SHL_C_PRI:
+      NEXT();
+    OPCODE(SHL_C_PRI):
       GETPARAM(offs);
       pri<<=offs;
-      break;
-    case AMX_OP_SHL_C_ALT:
+      NEXT();
+    OPCODE(SHL_C_ALT):
       GETPARAM(offs);
       alt<<=offs;
-      break;
-    case AMX_OP_SHR_C_PRI:
+      NEXT();
+    OPCODE(SHR_C_PRI):
       GETPARAM(offs);
       pri=(ucell)pri >> (int)offs;
-      break;
-    case AMX_OP_SHR_C_ALT:
+      NEXT();
+    OPCODE(SHR_C_ALT):
       GETPARAM(offs);
       alt=(ucell)alt >> (int)offs;
-      break;
-    case AMX_OP_SMUL:
+      NEXT();
+    OPCODE(SMUL):
       pri*=alt;
-      break;
-    case AMX_OP_SDIV:
+      NEXT();
+    OPCODE(SDIV):
       if (alt==0)
         ABORT(_amx,AMX_ERR_DIVIDE);
       /* use floored division and matching remainder */
@@ -568,8 +911,8 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         pri--;
         alt+=offs;
       } /* if */
-      break;
-    case AMX_OP_SDIV_ALT:
+      NEXT();
+    OPCODE(SDIV_ALT):
       if (pri==0)
         ABORT(_amx,AMX_ERR_DIVIDE);
       /* use floored division and matching remainder */
@@ -581,126 +924,126 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         pri--;
         alt+=offs;
       } /* if */
-      break;
-    case AMX_OP_UMUL:
+      NEXT();
+    OPCODE(UMUL):
       pri=(ucell)pri * (ucell)alt;
-      break;
-    case AMX_OP_UDIV:
+      NEXT();
+    OPCODE(UDIV):
       if (alt==0)
         ABORT(_amx,AMX_ERR_DIVIDE);
       offs=(ucell)pri % (ucell)alt;     /* temporary storage */
       pri=(ucell)pri / (ucell)alt;
       alt=offs;
-      break;
-    case AMX_OP_UDIV_ALT:
+      NEXT();
+    OPCODE(UDIV_ALT):
       if (pri==0)
         ABORT(_amx,AMX_ERR_DIVIDE);
       offs=(ucell)alt % (ucell)pri;     /* temporary storage */
       pri=(ucell)alt / (ucell)pri;
       alt=offs;
-      break;
-    case AMX_OP_ADD:
+      NEXT();
+    OPCODE(ADD):
       pri+=alt;
-      break;
-    case AMX_OP_SUB:
+      NEXT();
+    OPCODE(SUB):
       pri-=alt;
-      break;
-    case AMX_OP_SUB_ALT:
+      NEXT();
+    OPCODE(SUB_ALT):
       pri=alt-pri;
-      break;
-    case AMX_OP_AND:
+      NEXT();
+    OPCODE(AND):
       pri&=alt;
-      break;
-    case AMX_OP_OR:
+      NEXT();
+    OPCODE(OR):
       pri|=alt;
-      break;
-    case AMX_OP_XOR:
+      NEXT();
+    OPCODE(XOR):
       pri^=alt;
-      break;
-    case AMX_OP_NOT:
+      NEXT();
+    OPCODE(NOT):
       pri=!pri;
-      break;
-    case AMX_OP_NEG:
+      NEXT();
+    OPCODE(NEG):
       pri=-pri;
-      break;
-    case AMX_OP_INVERT:
+      NEXT();
+    OPCODE(INVERT):
       pri=~pri;
-      break;
-    case AMX_OP_ADD_C:
+      NEXT();
+    OPCODE(ADD_C):
       GETPARAM(offs);
       pri+=offs;
-      break;
-    case AMX_OP_SMUL_C:
+      NEXT();
+    OPCODE(SMUL_C):
       GETPARAM(offs);
       pri*=offs;
-      break;
-    case AMX_OP_ZERO_PRI:
+      NEXT();
+    OPCODE(ZERO_PRI):
       pri=0;
-      break;
-    case AMX_OP_ZERO_ALT:
+      NEXT();
+    OPCODE(ZERO_ALT):
       alt=0;
-      break;
-    case AMX_OP_ZERO:
+      NEXT();
+    OPCODE(ZERO):
       GETPARAM(offs);
       _W(data,offs,0);
-      break;
-    case AMX_OP_ZERO_S:
+      NEXT();
+    OPCODE(ZERO_S):
       GETPARAM(offs);
       _W(data,frm+offs,0);
-      break;
-    case AMX_OP_SIGN_PRI:
+      NEXT();
+    OPCODE(SIGN_PRI):
       if ((pri & 0xff)>=0x80)
         pri|= ~ (ucell)0xff;
-      break;
-    case AMX_OP_SIGN_ALT:
+      NEXT();
+    OPCODE(SIGN_ALT):
       if ((alt & 0xff)>=0x80)
         alt|= ~ (ucell)0xff;
-      break;
-    case AMX_OP_EQ:
+      NEXT();
+    OPCODE(EQ):
       pri= pri==alt ? 1 : 0;
-      break;
-    case AMX_OP_NEQ:
+      NEXT();
+    OPCODE(NEQ):
       pri= pri!=alt ? 1 : 0;
-      break;
-    case AMX_OP_LESS:
+      NEXT();
+    OPCODE(LESS):
       pri= (ucell)pri < (ucell)alt ? 1 : 0;
-      break;
-    case AMX_OP_LEQ:
+      NEXT();
+    OPCODE(LEQ):
       pri= (ucell)pri <= (ucell)alt ? 1 : 0;
-      break;
-    case AMX_OP_GRTR:
+      NEXT();
+    OPCODE(GRTR):
       pri= (ucell)pri > (ucell)alt ? 1 : 0;
-      break;
-    case AMX_OP_GEQ:
+      NEXT();
+    OPCODE(GEQ):
       pri= (ucell)pri >= (ucell)alt ? 1 : 0;
-      break;
-    case AMX_OP_SLESS:
+      NEXT();
+    OPCODE(SLESS):
       pri= pri<alt ? 1 : 0;
-      break;
-    case AMX_OP_SLEQ:
+      NEXT();
+    OPCODE(SLEQ):
       pri= pri<=alt ? 1 : 0;
-      break;
-    case AMX_OP_SGRTR:
+      NEXT();
+    OPCODE(SGRTR):
       pri= pri>alt ? 1 : 0;
-      break;
-    case AMX_OP_SGEQ:
+      NEXT();
+    OPCODE(SGEQ):
       pri= pri>=alt ? 1 : 0;
-      break;
-    case AMX_OP_EQ_C_PRI:
+      NEXT();
+    OPCODE(EQ_C_PRI):
       GETPARAM(offs);
       pri= pri==offs ? 1 : 0;
-      break;
-    case AMX_OP_EQ_C_ALT:
+      NEXT();
+    OPCODE(EQ_C_ALT):
       GETPARAM(offs);
       pri= alt==offs ? 1 : 0;
-      break;
-    case AMX_OP_INC_PRI:
+      NEXT();
+    OPCODE(INC_PRI):
       pri++;
-      break;
-    case AMX_OP_INC_ALT:
+      NEXT();
+    OPCODE(INC_ALT):
       alt++;
-      break;
-    case AMX_OP_INC:
+      NEXT();
+    OPCODE(INC):
       GETPARAM(offs);
       #if defined _R_DEFAULT
         *(cell *)(data+(int)offs) += 1;
@@ -708,8 +1051,8 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         val=_R(data,offs);
         _W(data,offs,val+1);
       #endif
-      break;
-    case AMX_OP_INC_S:
+      NEXT();
+    OPCODE(INC_S):
       GETPARAM(offs);
       #if defined _R_DEFAULT
         *(cell *)(data+(int)(frm+offs)) += 1;
@@ -717,22 +1060,22 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         val=_R(data,frm+offs);
         _W(data,frm+offs,val+1);
       #endif
-      break;
-    case AMX_OP_INC_I:
+      NEXT();
+    OPCODE(INC_I):
       #if defined _R_DEFAULT
         *(cell *)(data+(int)pri) += 1;
       #else
         val=_R(data,pri);
         _W(data,pri,val+1);
       #endif
-      break;
-    case AMX_OP_DEC_PRI:
+      NEXT();
+    OPCODE(DEC_PRI):
       pri--;
-      break;
-    case AMX_OP_DEC_ALT:
+      NEXT();
+    OPCODE(DEC_ALT):
       alt--;
-      break;
-    case AMX_OP_DEC:
+      NEXT();
+    OPCODE(DEC):
       GETPARAM(offs);
       #if defined _R_DEFAULT
         *(cell *)(data+(int)offs) -= 1;
@@ -740,8 +1083,8 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         val=_R(data,offs);
         _W(data,offs,val-1);
       #endif
-      break;
-    case AMX_OP_DEC_S:
+      NEXT();
+    OPCODE(DEC_S):
       GETPARAM(offs);
       #if defined _R_DEFAULT
         *(cell *)(data+(int)(frm+offs)) -= 1;
@@ -749,16 +1092,16 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         val=_R(data,frm+offs);
         _W(data,frm+offs,val-1);
       #endif
-      break;
-    case AMX_OP_DEC_I:
+      NEXT();
+    OPCODE(DEC_I):
       #if defined _R_DEFAULT
         *(cell *)(data+(int)pri) -= 1;
       #else
         val=_R(data,pri);
         _W(data,pri,val-1);
       #endif
-      break;
-    case AMX_OP_MOVS:
+      NEXT();
+    OPCODE(MOVS):
       GETPARAM(offs);
       /* verify top & bottom memory addresses, for both source and destination
        * addresses
@@ -783,8 +1126,8 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
           _W8(data,alt+i,val);
         } /* for */
       #endif
-      break;
-    case AMX_OP_CMPS:
+      NEXT();
+    OPCODE(CMPS):
       GETPARAM(offs);
       /* verify top & bottom memory addresses, for both source and destination
        * addresses
@@ -806,8 +1149,8 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         for ( ; i<offs && pri==0; i++)
           pri=_R8(data,alt+i)-_R8(data,pri+i);
       #endif
-      break;
-    case AMX_OP_FILL:
+      NEXT();
+    OPCODE(FILL):
       GETPARAM(offs);
       /* verify top & bottom memory addresses (destination only) */
       if (alt>=hea && alt<stk || (ucell)alt>=(ucell)_amx->stp)
@@ -816,8 +1159,8 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         ABORT(_amx,AMX_ERR_MEMACCESS);
       for (i=(int)alt; (size_t)offs>=sizeof(cell); i+=sizeof(cell), offs-=sizeof(cell))
         _W32(data,i,pri);
-      break;
-    case AMX_OP_HALT:
+      NEXT();
+    OPCODE(HALT):
       GETPARAM(offs);
       if (retval!=NULL)
         *retval=pri;
@@ -825,7 +1168,7 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
       _amx->frm=frm;
       _amx->pri=pri;
       _amx->alt=alt;
-      _amx->cip=(cell)((unsigned char*)cip-code);
+      _amx->cip=cip->address;
       if (offs==AMX_ERR_SLEEP) {
         _amx->stk=stk;
         _amx->hea=hea;
@@ -834,20 +1177,23 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         return (int)offs;
       } /* if */
       ABORT(_amx,(int)offs);
-    case AMX_OP_BOUNDS:
+    OPCODE(BOUNDS):
       GETPARAM(offs);
       if ((ucell)pri>(ucell)offs) {
-        _amx->cip=(cell)((unsigned char *)cip-code);
+        _amx->cip=cip->address;
         ABORT(_amx,AMX_ERR_BOUNDS);
       } /* if */
-      break;
-    case AMX_OP_SYSREQ_PRI:
+      NEXT();
+    OPCODE(SYSREQ_PRI):
       /* save a few registers */
-      _amx->cip=(cell)((unsigned char *)cip-code);
+      _amx->cip=cip->address;
       _amx->hea=hea;
       _amx->frm=frm;
       _amx->stk=stk;
-      num=_amx->callback(_amx,pri,&pri,(cell *)(data+(int)stk));
+      offs=pri;
+      if (call_profiler_!=NULL)
+        ticks=AMXCallProfiler::Now();
+      num=_amx->callback(_amx,offs,&pri,(cell *)(data+(int)stk));
       if (num!=AMX_ERR_NONE) {
         if (num==AMX_ERR_SLEEP) {
           _amx->pri=pri;
@@ -858,14 +1204,18 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         } /* if */
         ABORT(_amx,num);
       } /* if */
-      break;
-    case AMX_OP_SYSREQ_C:
+      if (call_profiler_!=NULL)
+        call_profiler_->Native(cip-1,offs,ticks);
+      NEXT();
+    OPCODE(SYSREQ_C):
       GETPARAM(offs);
       /* save a few registers */
-      _amx->cip=(cell)((unsigned char *)cip-code);
+      _amx->cip=cip->address;
       _amx->hea=hea;
       _amx->frm=frm;
       _amx->stk=stk;
+      if (call_profiler_!=NULL)
+        ticks=AMXCallProfiler::Now();
       num=_amx->callback(_amx,offs,&pri,(cell *)(data+(int)stk));
       if (num!=AMX_ERR_NONE) {
         if (num==AMX_ERR_SLEEP) {
@@ -877,80 +1227,346 @@ int AMXExecutor::HandleAMXExec(cell *retval, int index) {
         } /* if */
         ABORT(_amx,num);
       } /* if */
-      break;
-    case AMX_OP_LINE:
-      SKIPPARAM(2);
-      break;
-    case AMX_OP_SYMBOL:
-      GETPARAM(offs);
-      cip=(cell *)((unsigned char *)cip + (int)offs);
-      break;
-    case AMX_OP_SRANGE:
-      SKIPPARAM(2);
-      break;
-    case AMX_OP_SYMTAG:
-      SKIPPARAM(1);
-      break;
-    case AMX_OP_JUMP_PRI:
-      cip=(cell *)(code+(int)pri);
-      break;
-    case AMX_OP_SWITCH: {
-      cell *cptr;
+      if (call_profiler_!=NULL)
+        call_profiler_->Native(cip-1,offs,ticks);
+      NEXT();
+    OPCODE(LINE):
+      NEXT();
+    OPCODE(SYMBOL):
+      NEXT();
+    OPCODE(SRANGE):
+      NEXT();
+    OPCODE(SYMTAG):
+      NEXT();
+    OPCODE(JUMP_PRI):
+      cip=program_.Find(pri);
+      if (cip==NULL)
+        ABORT(_amx,AMX_ERR_MEMACCESS);
+      NEXT();
+    OPCODE(SWITCH): {
+      const AMXInstruction *cptr;
 
-      cptr=JUMPABS(code,cip)+1; /* +1, to skip the "casetbl" opcode */
-      cip=JUMPABS(code,cptr+1); /* preset to "none-matched" case */
-      num=(int)*cptr;           /* number of records in the case table */
-      for (cptr+=2; num>0 && *cptr!=pri; num--,cptr+=2)
+      cptr=JUMPTARGET();        /* the case table header */
+      cip=cptr->target;         /* preset to "none-matched" case */
+      num=(int)cptr->operand;   /* number of records in the case table */
+      for (cptr++; num>0 && cptr->operand!=pri; num--,cptr++)
         /* nothing */;
       if (num>0)
-        cip=JUMPABS(code,cptr+1); /* case found */
-      break;
+        cip=cptr->target;       /* case found */
+      NEXT();
     } /* case */
-    case AMX_OP_SWAP_PRI:
+    OPCODE(SWAP_PRI):
       offs=_R(data,stk);
       _W32(data,stk,pri);
       pri=offs;
-      break;
-    case AMX_OP_SWAP_ALT:
+      NEXT();
+    OPCODE(SWAP_ALT):
       offs=_R(data,stk);
       _W32(data,stk,alt);
       alt=offs;
-      break;
-    case AMX_OP_PUSH_ADR:
+      NEXT();
+    OPCODE(PUSH_ADR):
       GETPARAM(offs);
       PUSH(frm+offs);
-      break;
-    case AMX_OP_NOP:
-      break;
-    case AMX_OP_BREAK:
+      NEXT();
+    OPCODE(NOP):
+      NEXT();
+    OPCODE(BREAK):
       // Already handled for all instructions
-      break;
+      NEXT();
+
+    /* superinstructions (see FuseInstructions), each one runs a sequence of
+     * the above
+     */
+    OPCODE(PUSH5_C):
+      GETPARAM(offs);
+      PUSH(offs);
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH4_C):
+      GETPARAM(offs);
+      PUSH(offs);
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH3_C):
+      GETPARAM(offs);
+      PUSH(offs);
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH2_C):
+      GETPARAM_P(offs,0);
+      PUSH(offs);
+      GETPARAM_P(offs,1);
+      PUSH(offs);
+      SKIPINSN(1);
+      NEXT();
+    OPCODE(PUSH5):
+      GETPARAM(offs);
+      PUSH(_R(data,offs));
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH4):
+      GETPARAM(offs);
+      PUSH(_R(data,offs));
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH3):
+      GETPARAM(offs);
+      PUSH(_R(data,offs));
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH2):
+      GETPARAM_P(offs,0);
+      PUSH(_R(data,offs));
+      GETPARAM_P(offs,1);
+      PUSH(_R(data,offs));
+      SKIPINSN(1);
+      NEXT();
+    OPCODE(PUSH5_S):
+      GETPARAM(offs);
+      PUSH(_R(data,frm+offs));
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH4_S):
+      GETPARAM(offs);
+      PUSH(_R(data,frm+offs));
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH3_S):
+      GETPARAM(offs);
+      PUSH(_R(data,frm+offs));
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH2_S):
+      GETPARAM_P(offs,0);
+      PUSH(_R(data,frm+offs));
+      GETPARAM_P(offs,1);
+      PUSH(_R(data,frm+offs));
+      SKIPINSN(1);
+      NEXT();
+    OPCODE(PUSH5_ADR):
+      GETPARAM(offs);
+      PUSH(frm+offs);
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH4_ADR):
+      GETPARAM(offs);
+      PUSH(frm+offs);
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH3_ADR):
+      GETPARAM(offs);
+      PUSH(frm+offs);
+      SKIPINSN(1);
+      /* fall through */
+    OPCODE(PUSH2_ADR):
+      GETPARAM_P(offs,0);
+      PUSH(frm+offs);
+      GETPARAM_P(offs,1);
+      PUSH(frm+offs);
+      SKIPINSN(1);
+      NEXT();
+    OPCODE(LOAD_BOTH):
+      GETPARAM_P(offs,0);
+      pri=_R(data,offs);
+      GETPARAM_P(offs,1);
+      alt=_R(data,offs);
+      SKIPINSN(1);
+      NEXT();
+    OPCODE(LOAD_S_BOTH):
+      GETPARAM_P(offs,0);
+      pri=_R(data,frm+offs);
+      GETPARAM_P(offs,1);
+      alt=_R(data,frm+offs);
+      SKIPINSN(1);
+      NEXT();
+    OPCODE(LOAD_PRI_PUSH_PRI):
+      GETPARAM_P(offs,0);
+      pri=_R(data,offs);
+      PUSH(pri);
+      SKIPINSN(1);
+      NEXT();
+    OPCODE(LOAD_S_PRI_PUSH_PRI):
+      GETPARAM_P(offs,0);
+      pri=_R(data,frm+offs);
+      PUSH(pri);
+      SKIPINSN(1);
+      NEXT();
+    OPCODE(ADDR_PRI_PUSH_PRI):
+      GETPARAM_P(pri,0);
+      pri+=frm;
+      PUSH(pri);
+      SKIPINSN(1);
+      NEXT();
+    OPCODE(CONST_PRI_PUSH_PRI):
+      GETPARAM_P(pri,0);
+      PUSH(pri);
+      SKIPINSN(1);
+      NEXT();
+    OPCODE(CONST_PRI_JZER):
+      GETPARAM_P(pri,0);
+      if (pri==0)
+        cip=JUMPTARGET_P(1);
+      else
+        SKIPINSN(1);
+      NEXT();
+#if defined AMX_THREADED_DISPATCH
+    op_invalid:
+#else
     default:
+#endif
       /* case AMX_OP_FILE:          should not occur during execution
        * case AMX_OP_CASETBL:       should not occur during execution
        */
       assert(0);
+      _amx->cip=cip[-1].address;
       ABORT(_amx,AMX_ERR_INVINSTR);
-    } /* switch */
+#if !defined AMX_THREADED_DISPATCH
+  } /* switch */
+#endif
 
-    assert((_amx->flags & AMX_FLAG_BROWSE)==0);
-    if (_amx->debug!=NULL) {
-      /* store status */
-      _amx->pri=pri;
-      _amx->alt=alt;
+  /* Only reached when at least one of the EXEC_* flags is set. The debug hook
+   * sees CIP pointing at the instruction that is about to run, which is the
+   * same as the state right after the previous one.
+   */
+hook:
+  flags=flags_.load(std::memory_order_relaxed);
+  assert((_amx->flags & AMX_FLAG_BROWSE)==0);
+  if ((flags & EXEC_SAMPLE)!=0) {
+    AMXProfiler *profiler=profiler_.load(std::memory_order_acquire);
+    DisableFlags(EXEC_SAMPLE);
+    if (profiler!=NULL) {
+      /* the stack walker works on the AMX structure */
       _amx->frm=frm;
       _amx->stk=stk;
       _amx->hea=hea;
-      _amx->cip=(cell)((unsigned char*)cip-code);
-      num=_amx->debug(_amx);
-      if (num!=AMX_ERR_NONE) {
-        if (num==AMX_ERR_SLEEP) {
-          _amx->reset_stk=reset_stk;
-          _amx->reset_hea=reset_hea;
-          return num;
-        } /* if */
-        ABORT(_amx,num);
+      profiler->Sample(_amx,cip->address);
+    } /* if */
+  } /* if */
+  if ((flags & EXEC_BACKTRACE)!=0) {
+    DisableFlags(EXEC_BACKTRACE);
+    _amx->frm=frm;
+    _amx->stk=stk;
+    _amx->hea=hea;
+    RecordBacktrace(cip->address);
+  } /* if */
+  if (watch_hit_ && (flags & EXEC_WATCHPOINTS)==0)
+    watch_hit_=false;         /* the watchpoint was removed before it fired */
+  if (((flags & EXEC_DEBUG)!=0
+       || ((flags & EXEC_BREAKPOINTS)!=0 && HasBreakpoint(cip->address))
+       || watch_hit_)
+      && _amx->debug!=NULL) {
+    /* store status */
+    _amx->pri=pri;
+    _amx->alt=alt;
+    _amx->frm=frm;
+    _amx->stk=stk;
+    _amx->hea=hea;
+    _amx->cip=cip->address;
+    /* nothing here holds on to a watchpoint set now */
+    if (has_retired_watchpoints_.load(std::memory_order_relaxed))
+      FreeRetiredWatchpoints();
+    num=_amx->debug(_amx);
+    if (num!=AMX_ERR_NONE) {
+      if (num==AMX_ERR_SLEEP) {
+        _amx->reset_stk=reset_stk;
+        _amx->reset_hea=reset_hea;
+        return num;
       } /* if */
+      ABORT(_amx,num);
     } /* if */
-  } /* for */
-}
\ No newline at end of file
+  } /* if */
+  watch_hit_=false;
+  if ((flags & EXEC_WATCHPOINTS)!=0) {
+    /* work out what the instruction is going to write to, if anything */
+    offs=cip->operand;
+    num=sizeof(cell);
+    switch (program_.GetOpcode(cip)) {
+    case AMX_OP_STOR_PRI:
+    case AMX_OP_STOR_ALT:
+    case AMX_OP_ZERO:
+    case AMX_OP_INC:
+    case AMX_OP_DEC:
+      break;
+    case AMX_OP_STOR_S_PRI:
+    case AMX_OP_STOR_S_ALT:
+    case AMX_OP_ZERO_S:
+    case AMX_OP_INC_S:
+    case AMX_OP_DEC_S:
+      offs+=frm;
+      break;
+    case AMX_OP_SREF_PRI:
+    case AMX_OP_SREF_ALT:
+      offs=_R(data,offs);
+      break;
+    case AMX_OP_SREF_S_PRI:
+    case AMX_OP_SREF_S_ALT:
+      offs=_R(data,frm+offs);
+      break;
+    case AMX_OP_STOR_I:
+      offs=alt;
+      break;
+    case AMX_OP_INC_I:
+    case AMX_OP_DEC_I:
+      offs=pri;
+      break;
+    case AMX_OP_STRB_I:
+    case AMX_OP_MOVS:
+    case AMX_OP_FILL:
+      num=(int)offs;
+      offs=alt;
+      break;
+    default:
+      num=0;
+      break;
+    } /* switch */
+    if (num>0
+        && watchpoints_.load(std::memory_order_acquire)->Overlaps(offs,offs+num)) {
+      /* the hook is called before the next instruction */
+      watch_hit_=true;
+      watch_hit_address_=offs;
+      watch_hit_instruction_=cip->address;
+    } /* if */
+  } /* if */
+  if ((flags & EXEC_TRACE)!=0) {
+    std::string_view name=AMXOpcodeNames[program_.GetOpcode(cip)];
+    LogTracePrint("%08X %.*s %d",
+                  cip->address,
+                  (int)name.size(), name.data(),
+                  cip->operand);
+  } /* if */
+  if ((flags & EXEC_THROTTLE)!=0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(throttle_delay_));
+  if ((flags & EXEC_COUNT)!=0)
+    opcode_counter_->Count(cip);
+  /* Run the original instruction rather than a superinstruction starting
+   * at it, so that the hook gets to see every instruction.
+   */
+#if defined AMX_THREADED_DISPATCH
+  goto *handlers[program_.GetOpcode(cip++)];
+#else
+  op=program_.GetOpcode(cip++);
+  goto dispatch;
+#endif
+}
+
+// static
+const cell *AMXExecutor::GetOpcodeTable() {
+  #if defined AMX_THREADED_DISPATCH
+    static const cell *opcode_table = 0;
+    if (opcode_table==0) {
+      AMX amx = {0};
+      amx.flags |= AMX_FLAG_BROWSE;
+      AMXExecutor executor(&amx);
+      executor.HandleAMXExec((cell *)&opcode_table, 0);
+    }
+    return opcode_table;
+  #else
+    static cell opcode_table[NUM_EXEC_OPCODES];
+    if (opcode_table[NUM_EXEC_OPCODES-1]==0) {
+      for (int i=0; i<NUM_EXEC_OPCODES; i++)
+        opcode_table[i]=i;
+    }
+    return opcode_table;
+  #endif
+}
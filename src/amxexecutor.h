@@ -1,19 +1,151 @@
 #ifndef AMXEXECUTOR_H
 #define AMXEXECUTOR_H
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
 #include <amx/amx.h>
 #include <amx/osdefs.h>
 
+#include "amxprogram.h"
 #include "amxservice.h"
+#include "intervalset.h"
+
+class AMXCallProfiler;
+class AMXOpcodeCounter;
+class AMXProfiler;
 
 class AMXExecutor : public AMXService<AMXExecutor> {
  friend class AMXService<AMXExecutor>;
 
  public:
+  // Optional per-instruction work. With no flags set the executor runs in
+  // "free run" mode and does nothing but interpret the code.
+  enum ExecFlags {
+    EXEC_NONE     = 0x00,
+    EXEC_TRACE    = 0x01, // log every executed instruction
+    EXEC_THROTTLE = 0x02, // sleep for throttle_delay() ms between instructions
+    EXEC_DEBUG    = 0x04, // call the AMX debug hook before every instruction
+    EXEC_BREAKPOINTS = 0x08, // call it only where there's a breakpoint
+    EXEC_WATCHPOINTS = 0x10, // call it after writes to watched memory
+    EXEC_SAMPLE   = 0x20, // give the profiler a sample, then clear this
+    EXEC_BACKTRACE = 0x40, // record the Pawn call stack, then clear this
+    EXEC_COUNT    = 0x80  // count every instruction in the opcode counter
+  };
+
+  // Decodes the code of the script. HandleAMXExec() does this on first use
+  // if it wasn't done in advance.
+  int Load();
+
+  // Replaces common instruction sequences (runs of pushes, load + push,
+  // const + jzer, ...) with superinstructions. This only changes the decoded
+  // program: code addresses seen by the script and the debugger stay the same.
+  // Returns the number of superinstructions.
+  int FuseInstructions();
+  void UnfuseInstructions();
+
   int HandleAMXExec(cell *retval, int index);
 
+  // Returns what amx_Init() should store in place of each opcode: handler
+  // addresses for the threaded interpreter or plain opcode numbers. The
+  // table is followed by the handlers of superinstructions.
+  static const cell *GetOpcodeTable();
+
+  int flags() const { return flags_.load(std::memory_order_relaxed); }
+
+  void EnableFlags(int flags) { flags_.fetch_or(flags); }
+  void DisableFlags(int flags) { flags_.fetch_and(~flags); }
+
+  int throttle_delay() const { return throttle_delay_; }
+  void set_throttle_delay(int delay) { throttle_delay_ = delay; }
+
+  const AMXProgram &program() const { return program_; }
+
+  // Breakpoints are kept in a bitmap indexed by code address, so checking
+  // for one costs a single bit test. EXEC_BREAKPOINTS is set while there is
+  // at least one. These can be called from any thread.
+  bool SetBreakpoint(cell address);
+  bool RemoveBreakpoint(cell address);
+  void RemoveAllBreakpoints();
+
+  bool HasBreakpoint(cell address) const {
+    std::size_t index = static_cast<ucell>(address) / sizeof(cell);
+    return index / 32 < breakpoint_words_
+        && (breakpoints_[index / 32].load(std::memory_order_relaxed)
+            & (1u << (index % 32))) != 0;
+  }
+
+  // Watchpoints are ranges of the data section, heap or stack. While there
+  // is at least one, EXEC_WATCHPOINTS makes every instruction go through
+  // the hook, which works out what a store instruction is about to write
+  // and calls the debug hook right after it did if that overlaps a watched
+  // range. These can be called from any thread.
+  bool AddWatchpoint(cell address, cell size);
+  bool RemoveWatchpoint(cell address, cell size);
+  void RemoveAllWatchpoints();
+
+  // Tells whether the debug hook was called because of a watchpoint and if
+  // so, where the write went and which instruction did it. Only to be called
+  // from the debug hook.
+  bool TakeWatchpointHit(cell &address, cell &instruction);
+
+  // Gets the call stack recorded by the last EXEC_BACKTRACE, as return
+  // addresses with the innermost function first, and forgets it. Returns
+  // false if none was recorded since the last call. Only to be called on
+  // the script's thread.
+  bool TakeBacktrace(std::vector<cell> &frames);
+
+  // Where EXEC_SAMPLE sends samples; none are taken while this is null.
+  void set_profiler(AMXProfiler *profiler) { profiler_ = profiler; }
+
+  // Gets told about every function call and native call. Unlike the above
+  // this costs a check per call even when it's null, so it can't be turned
+  // on or off while the script is running.
+  void set_call_profiler(AMXCallProfiler *profiler) {
+    call_profiler_ = profiler;
+  }
+
+  // Where EXEC_COUNT sends instructions. Must be set before the flag is.
+  void set_opcode_counter(AMXOpcodeCounter *counter) {
+    opcode_counter_ = counter;
+  }
+
  private:
   AMXExecutor(AMX *amx);
+
+ private:
+  AMXProgram program_;
+  std::atomic<int> flags_;
+  int throttle_delay_;
+  std::unique_ptr<std::atomic<uint32_t>[]> breakpoints_;
+  std::size_t breakpoint_words_;
+  std::atomic<int> num_breakpoints_;
+
+  void UpdateWatchpoints();
+  void FreeRetiredWatchpoints();
+  void RecordBacktrace(cell cip);
+
+  // The interpreter reads watchpoints_ without locking. Replaced sets are
+  // kept at the front of watchpoint_sets_ (the current one is the last)
+  // until the script thread frees them at its next debug hook stop, where
+  // it's known not to be looking at any of them.
+  std::mutex watchpoints_mutex_;
+  std::vector<std::pair<cell, cell>> watchpoint_ranges_;
+  std::vector<std::unique_ptr<IntervalSet>> watchpoint_sets_;
+  std::atomic<const IntervalSet*> watchpoints_;
+  std::atomic<bool> has_retired_watchpoints_;
+  bool watch_hit_;
+  cell watch_hit_address_;
+  cell watch_hit_instruction_;
+  std::vector<cell> backtrace_;
+  bool has_backtrace_;
+  std::atomic<AMXProfiler*> profiler_;
+  AMXCallProfiler *call_profiler_;
+  AMXOpcodeCounter *opcode_counter_;
 };
 
-#endif // !AMXEXECUTOR_H
\ No newline at end of file
+#endif // !AMXEXECUTOR_H
@@ -0,0 +1,168 @@
+#ifndef AMXINSTANCEMAP_H
+#define AMXINSTANCEMAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <amx/amx.h>
+
+// Maps scripts to per-script objects. This is an open-addressed hash table
+// with linear probing: Find() takes no locks and touches one or two cache
+// lines, so it's cheap enough to call on every native call and debug hook.
+// Insert() and Remove() are serialized by a mutex and may run concurrently
+// with Find().
+//
+// When the table fills up it's copied into a larger one. Old tables are kept
+// until the map is destroyed, as a reader might still be looking at them.
+template<typename T>
+class AMXInstanceMap {
+ public:
+  AMXInstanceMap() : table_(new Table(kInitialCapacity)) {}
+
+  ~AMXInstanceMap() {
+    delete table_.load();
+    for (std::size_t i = 0; i < retired_.size(); i++) {
+      delete retired_[i];
+    }
+  }
+
+  T *Find(const AMX *amx) const {
+    const Table *table = table_.load(std::memory_order_acquire);
+    std::size_t mask = table->capacity - 1;
+    for (std::size_t i = Hash(table, amx); ; i = (i + 1) & mask) {
+      const AMX *key = table->slots[i].key.load(std::memory_order_acquire);
+      if (key == amx) {
+        return table->slots[i].value.load(std::memory_order_relaxed);
+      }
+      if (key == 0) {
+        return 0;
+      }
+    }
+  }
+
+  // Adds or replaces the object of a script.
+  void Insert(const AMX *amx, T *value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Table *table = table_.load(std::memory_order_relaxed);
+    if (2 * (table->used + 1) > table->capacity) {
+      table = Grow(table);
+    }
+    Slot *slot = Probe(table, amx);
+    const AMX *key = slot->key.load(std::memory_order_relaxed);
+    slot->value.store(value, std::memory_order_relaxed);
+    if (key != amx) {
+      if (key == 0) {
+        table->used++;
+      }
+      slot->key.store(amx, std::memory_order_release);
+    }
+  }
+
+  // Returns the removed object or null.
+  T *Remove(const AMX *amx) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Table *table = table_.load(std::memory_order_relaxed);
+    Slot *slot = Probe(table, amx);
+    if (slot->key.load(std::memory_order_relaxed) != amx) {
+      return 0;
+    }
+    // Leave a tombstone so that probes for other scripts go on past it.
+    T *value = slot->value.load(std::memory_order_relaxed);
+    slot->key.store(Tombstone(), std::memory_order_release);
+    slot->value.store(0, std::memory_order_relaxed);
+    return value;
+  }
+
+ private:
+  static const std::size_t kInitialCapacity = 64;
+
+  struct Slot {
+    Slot() : key(0), value(0) {}
+    std::atomic<const AMX*> key;
+    std::atomic<T*> value;
+  };
+
+  struct Table {
+    explicit Table(std::size_t capacity)
+     : capacity(capacity), shift(32), used(0), slots(new Slot[capacity]) {
+      for (std::size_t n = capacity; n > 1; n >>= 1) {
+        shift--;
+      }
+    }
+    ~Table() { delete[] slots; }
+    std::size_t capacity; // a power of two
+    int shift;
+    std::size_t used; // live entries and tombstones
+    Slot *slots;
+  };
+
+  // Fibonacci hashing: the top bits of the product depend on all bits of
+  // the address, so scripts that sit next to each other in memory don't end
+  // up in neighboring slots.
+  static std::size_t Hash(const Table *table, const AMX *amx) {
+    uint32_t x = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(amx));
+    return (x * 2654435769u) >> table->shift;
+  }
+
+  static const AMX *Tombstone() {
+    return reinterpret_cast<const AMX*>(1);
+  }
+
+  // Returns the slot that holds the script or, failing that, the first
+  // free one (preferably a tombstone) where it can go.
+  static Slot *Probe(Table *table, const AMX *amx) {
+    std::size_t mask = table->capacity - 1;
+    Slot *free = 0;
+    for (std::size_t i = Hash(table, amx); ; i = (i + 1) & mask) {
+      Slot *slot = &table->slots[i];
+      const AMX *key = slot->key.load(std::memory_order_relaxed);
+      if (key == amx) {
+        return slot;
+      }
+      if (key == Tombstone() && free == 0) {
+        free = slot;
+      }
+      if (key == 0) {
+        return free != 0 ? free : slot;
+      }
+    }
+  }
+
+  Table *Grow(Table *table) {
+    std::size_t live = 0;
+    for (std::size_t i = 0; i < table->capacity; i++) {
+      const AMX *key = table->slots[i].key.load(std::memory_order_relaxed);
+      if (key != 0 && key != Tombstone()) {
+        live++;
+      }
+    }
+    std::size_t capacity = table->capacity;
+    while (4 * (live + 1) > capacity) {
+      capacity *= 2;
+    }
+    Table *new_table = new Table(capacity);
+    for (std::size_t i = 0; i < table->capacity; i++) {
+      const AMX *key = table->slots[i].key.load(std::memory_order_relaxed);
+      if (key != 0 && key != Tombstone()) {
+        Slot *slot = Probe(new_table, key);
+        slot->value.store(table->slots[i].value.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+        slot->key.store(key, std::memory_order_relaxed);
+        new_table->used++;
+      }
+    }
+    table_.store(new_table, std::memory_order_release);
+    retired_.push_back(table);
+    return new_table;
+  }
+
+ private:
+  std::atomic<Table*> table_;
+  std::vector<Table*> retired_;
+  std::mutex mutex_;
+};
+
+#endif // !AMXINSTANCEMAP_H
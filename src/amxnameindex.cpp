@@ -0,0 +1,76 @@
+#include "amxnameindex.h"
+
+AMXNameIndex::AMXNameIndex(AMX *amx)
+ : AMXService<AMXNameIndex>(amx),
+   public_names_built_(false),
+   native_names_built_(false),
+   public_addresses_built_(false),
+   native_addresses_complete_(false)
+{
+}
+
+int AMXNameIndex::GetPublicIndex(const char *name) {
+  if (!public_names_built_) {
+    BuildNames(public_names_, amx().GetPublics(), amx().GetNumPublics());
+    public_names_built_ = true;
+  }
+  NameMap::const_iterator iterator = public_names_.find(name);
+  return iterator != public_names_.end() ? iterator->second : -1;
+}
+
+int AMXNameIndex::GetNativeIndex(const char *name) {
+  if (!native_names_built_) {
+    BuildNames(native_names_, amx().GetNatives(), amx().GetNumNatives());
+    native_names_built_ = true;
+  }
+  NameMap::const_iterator iterator = native_names_.find(name);
+  return iterator != native_names_.end() ? iterator->second : -1;
+}
+
+int AMXNameIndex::FindPublic(cell address) {
+  if (!public_addresses_built_) {
+    BuildAddresses(public_addresses_,
+                   amx().GetPublics(), amx().GetNumPublics());
+    public_addresses_built_ = true;
+  }
+  AddressMap::const_iterator iterator = public_addresses_.find(address);
+  return iterator != public_addresses_.end() ? iterator->second : -1;
+}
+
+int AMXNameIndex::FindNative(cell address) {
+  AddressMap::const_iterator iterator = native_addresses_.find(address);
+  if (iterator != native_addresses_.end()) {
+    return iterator->second;
+  }
+  if (native_addresses_complete_) {
+    return -1;
+  }
+  // amx_Register() sets the flag once every native has an address.
+  native_addresses_complete_ = (amx().GetFlags() & AMX_FLAG_NTVREG) != 0;
+  BuildAddresses(native_addresses_, amx().GetNatives(), amx().GetNumNatives());
+  iterator = native_addresses_.find(address);
+  return iterator != native_addresses_.end() ? iterator->second : -1;
+}
+
+void AMXNameIndex::BuildNames(NameMap &names,
+                              const AMX_FUNCSTUBNT *entries, int n) {
+  // Names point into the AMX image, which outlives this object. Duplicates
+  // resolve to the first entry, like a linear search would.
+  names.clear();
+  names.reserve(n);
+  for (int i = 0; i < n; i++) {
+    names.insert(std::make_pair(amx().GetName(entries[i].nameofs), i));
+  }
+}
+
+void AMXNameIndex::BuildAddresses(AddressMap &addresses,
+                                  const AMX_FUNCSTUBNT *entries, int n) {
+  addresses.clear();
+  addresses.reserve(n);
+  for (int i = 0; i < n; i++) {
+    if (entries[i].address != 0) {
+      addresses.insert(
+        std::make_pair(static_cast<cell>(entries[i].address), i));
+    }
+  }
+}
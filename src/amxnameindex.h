@@ -0,0 +1,47 @@
+#ifndef AMXNAMEINDEX_H
+#define AMXNAMEINDEX_H
+
+#include <string_view>
+#include <unordered_map>
+
+#include <amx/amx.h>
+
+#include "amxservice.h"
+
+// Hash tables for looking up publics and natives of a script by name or by
+// address. Each table is built on first use and lives until the script is
+// unloaded. Native addresses are only filled in as plugins register their
+// natives, so the native address table is rebuilt on a miss until all of
+// them are known.
+class AMXNameIndex : public AMXService<AMXNameIndex> {
+ friend class AMXService<AMXNameIndex>;
+
+ public:
+  // These return the index in the public/native table, or -1.
+  int GetPublicIndex(const char *name);
+  int GetNativeIndex(const char *name);
+  int FindPublic(cell address);
+  int FindNative(cell address);
+
+ private:
+  AMXNameIndex(AMX *amx);
+
+  typedef std::unordered_map<std::string_view, int> NameMap;
+  typedef std::unordered_map<cell, int> AddressMap;
+
+  void BuildNames(NameMap &names, const AMX_FUNCSTUBNT *entries, int n);
+  void BuildAddresses(AddressMap &addresses,
+                      const AMX_FUNCSTUBNT *entries, int n);
+
+ private:
+  bool public_names_built_;
+  bool native_names_built_;
+  bool public_addresses_built_;
+  bool native_addresses_complete_;
+  NameMap public_names_;
+  NameMap native_names_;
+  AddressMap public_addresses_;
+  AddressMap native_addresses_;
+};
+
+#endif // !AMXNAMEINDEX_H
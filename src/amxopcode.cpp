@@ -22,28 +22,45 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <unordered_map>
+
+#include "amxexecutor.h"
 #include "amxopcode.h"
 
-static cell *GetOpcodeMap() {
-  #if defined __GNUC__
-    cell *opcode_map;
-    AMX amx = {0};
-    amx.flags |= AMX_FLAG_BROWSE;
-    amx_Exec(&amx, reinterpret_cast<cell*>(&opcode_map), 0);
-    amx.flags &= ~AMX_FLAG_BROWSE;
-    return opcode_map;
-  #else
-    return 0;
-  #endif
+namespace {
+
+typedef std::unordered_map<cell, AMXOpcode> OpcodeMap;
+
+OpcodeMap MakeReverseOpcodeMap() {
+  OpcodeMap opcode_map;
+  const cell *opcode_table = AMXExecutor::GetOpcodeTable();
+  for (int i = 0; i < NUM_AMX_OPCODES; i++) {
+    // Unsupported opcodes all share one handler; the first one (OP_NONE)
+    // wins.
+    opcode_map.insert(std::make_pair(opcode_table[i],
+                                     static_cast<AMXOpcode>(i)));
+  }
+  return opcode_map;
 }
 
+} // anonymous namespace
+
+// The code is relocated by amx_Init() with the table that our own amx_Exec()
+// hook hands out, so that's what we use here too rather than the amx.c copy
+// linked into the plugin.
 cell RelocateAMXOpcode(cell opcode) {
-  #if defined __GNUC__
-    static cell *opcode_map = GetOpcodeMap();
-    if (opcode >= 0 && opcode < NUM_AMX_OPCODES) {
-      return opcode_map[opcode];
-    }
-  #endif
+  static const cell *opcode_table = AMXExecutor::GetOpcodeTable();
+  if (opcode >= 0 && opcode < NUM_AMX_OPCODES) {
+    return opcode_table[opcode];
+  }
   return opcode;
 }
 
+AMXOpcode UnrelocateAMXOpcode(cell opcode) {
+  static const OpcodeMap opcode_map = MakeReverseOpcodeMap();
+  OpcodeMap::const_iterator iterator = opcode_map.find(opcode);
+  if (iterator != opcode_map.end()) {
+    return iterator->second;
+  }
+  return AMX_OP_NONE;
+}
@@ -92,6 +92,7 @@ enum AMXOpcode {
 const int NUM_AMX_OPCODES = AMX_OP_LAST_;
 
 cell RelocateAMXOpcode(cell opcode);
+AMXOpcode UnrelocateAMXOpcode(cell opcode);
 
 constexpr std::array<std::string_view, NUM_AMX_OPCODES> AMXOpcodeNames = {
   "OP_NONE"sv,
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <utility>
+
+#include "amxdebuginfo.h"
+#include "amxopcodecounter.h"
+
+namespace {
+
+double Percent(uint64_t value, uint64_t total) {
+  return total > 0 ? value * 100.0 / total : 0.0;
+}
+
+} // anonymous namespace
+
+AMXOpcodeCounter::AMXOpcodeCounter(const AMXProgram &program)
+ : program_(program),
+   counts_(program.num_instructions() + 1)
+{
+}
+
+uint64_t AMXOpcodeCounter::total() const {
+  uint64_t total = 0;
+  for (std::size_t i = 0; i < program_.num_instructions(); i++) {
+    total += counts_[i];
+  }
+  return total;
+}
+
+// static
+bool AMXOpcodeCounter::IsBranch(AMXOpcode opcode) {
+  switch (opcode) {
+    case AMX_OP_RET:
+    case AMX_OP_RETN:
+    case AMX_OP_CALL:
+    case AMX_OP_CALL_PRI:
+    case AMX_OP_JUMP:
+    case AMX_OP_JREL:
+    case AMX_OP_JZER:
+    case AMX_OP_JNZ:
+    case AMX_OP_JEQ:
+    case AMX_OP_JNEQ:
+    case AMX_OP_JLESS:
+    case AMX_OP_JLEQ:
+    case AMX_OP_JGRTR:
+    case AMX_OP_JGEQ:
+    case AMX_OP_JSLESS:
+    case AMX_OP_JSLEQ:
+    case AMX_OP_JSGRTR:
+    case AMX_OP_JSGEQ:
+    case AMX_OP_HALT:
+    case AMX_OP_JUMP_PRI:
+    case AMX_OP_SWITCH:
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::vector<AMXOpcodeCounter::Block> AMXOpcodeCounter::FindBlocks() const {
+  // A block starts after a branch, at the start of a function, and wherever
+  // the count changes (which can only happen at a jump target). Merging
+  // neighbouring blocks that ran equally often changes nothing in the report.
+  std::vector<Block> blocks;
+  const AMXInstruction *instructions = program_.begin();
+  for (std::size_t i = 0; i < program_.num_instructions(); i++) {
+    AMXOpcode opcode = program_.GetOpcode(&instructions[i]);
+    bool is_leader = blocks.empty()
+      || opcode == AMX_OP_PROC
+      || counts_[i] != blocks.back().executions
+      || IsBranch(program_.GetOpcode(&instructions[i - 1]));
+    if (is_leader) {
+      Block block = {i, 0, counts_[i]};
+      blocks.push_back(block);
+    }
+    blocks.back().length++;
+  }
+  return blocks;
+}
+
+void AMXOpcodeCounter::WriteReport(std::ostream &stream,
+                                   const AMXDebugInfo &debug_info) const {
+  const AMXInstruction *instructions = program_.begin();
+  std::size_t num_instructions = program_.num_instructions();
+  uint64_t total = this->total();
+
+  std::vector<std::pair<uint64_t, int>> opcodes(NUM_AMX_OPCODES);
+  std::map<std::pair<int, int>, uint64_t> pair_counts;
+  for (std::size_t i = 0; i < num_instructions; i++) {
+    if (counts_[i] == 0) {
+      continue;
+    }
+    AMXOpcode opcode = program_.GetOpcode(&instructions[i]);
+    opcodes[opcode].first += counts_[i];
+    opcodes[opcode].second = opcode;
+
+    // Unless it's a branch, an instruction is always followed by the next.
+    if (i + 1 < num_instructions && !IsBranch(opcode)) {
+      AMXOpcode next = program_.GetOpcode(&instructions[i + 1]);
+      if (next != AMX_OP_PROC) {
+        pair_counts[std::make_pair(opcode, next)] += counts_[i];
+      }
+    }
+  }
+
+  stream << "Instructions executed: " << total << "\n"
+         << std::fixed << std::setprecision(2);
+
+  std::sort(opcodes.begin(), opcodes.end(),
+            std::greater<std::pair<uint64_t, int>>());
+  stream << "\nOpcodes:\n";
+  for (std::size_t i = 0; i < opcodes.size() && opcodes[i].first > 0; i++) {
+    stream << std::setw(16) << opcodes[i].first
+           << std::setw(8) << Percent(opcodes[i].first, total) << "%  "
+           << AMXOpcodeNames[opcodes[i].second] << "\n";
+  }
+
+  std::vector<std::pair<uint64_t, std::pair<int, int>>> pairs;
+  for (std::map<std::pair<int, int>, uint64_t>::const_iterator it =
+         pair_counts.begin(); it != pair_counts.end(); it++) {
+    pairs.push_back(std::make_pair(it->second, it->first));
+  }
+  std::sort(pairs.begin(), pairs.end(),
+            std::greater<std::pair<uint64_t, std::pair<int, int>>>());
+  stream << "\nPairs:\n";
+  for (std::size_t i = 0; i < pairs.size() && i < kMaxPairs; i++) {
+    stream << std::setw(16) << pairs[i].first
+           << std::setw(8) << Percent(pairs[i].first, total) << "%  "
+           << AMXOpcodeNames[pairs[i].second.first] << " "
+           << AMXOpcodeNames[pairs[i].second.second] << "\n";
+  }
+
+  std::vector<Block> blocks = FindBlocks();
+  std::sort(blocks.begin(), blocks.end(), [](const Block &a, const Block &b) {
+    return a.executions * a.length > b.executions * b.length;
+  });
+  stream << "\nBlocks:\n";
+  for (std::size_t i = 0; i < blocks.size() && i < kMaxBlocks; i++) {
+    const Block &block = blocks[i];
+    if (block.executions == 0) {
+      break;
+    }
+    cell start = instructions[block.first].address;
+    cell end = instructions[block.first + block.length].address;
+    uint64_t cost = block.executions * block.length;
+    stream << std::setw(16) << cost
+           << std::setw(8) << Percent(cost, total) << "%  "
+           << "0x" << std::hex << std::setfill('0')
+           << std::setw(8) << start << "-0x" << std::setw(8) << end
+           << std::dec << std::setfill(' ')
+           << "  " << block.length << " x " << block.executions;
+    if (debug_info.IsLoaded()) {
+      std::string function = debug_info.GetFunctionName(start);
+      std::string file = debug_info.GetFileName(start);
+      int32_t line = debug_info.GetLineNumber(start);
+      if (!function.empty()) {
+        stream << "  " << function;
+      }
+      if (!file.empty() && line >= 0) {
+        stream << " at " << file << ":" << line + 1;
+      }
+    }
+    stream << "\n";
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef AMXOPCODECOUNTER_H
+#define AMXOPCODECOUNTER_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+#include "amxopcode.h"
+#include "amxprogram.h"
+
+class AMXDebugInfo;
+
+// Counts how many times every instruction runs. There is one counter per
+// instruction of the decoded program, in code order, bumped by the executor
+// while EXEC_COUNT is set. Counting sends every instruction through the
+// executor's hook, so it's for finding out where a script spends its
+// instructions, not for leaving on.
+//
+// Per-opcode and per-block counts are worked out from these when the report
+// is written. Superinstructions don't matter: the hook always runs the
+// original instructions.
+//
+// Only used on the script's thread.
+class AMXOpcodeCounter {
+ public:
+  // How much of each kind of thing the report lists.
+  static const std::size_t kMaxPairs = 40;
+  static const std::size_t kMaxBlocks = 50;
+
+  // The program must already be decoded and must outlive the counter.
+  explicit AMXOpcodeCounter(const AMXProgram &program);
+
+  void Count(const AMXInstruction *instruction) {
+    counts_[instruction - program_.begin()]++;
+  }
+
+  // Total number of instructions executed.
+  uint64_t total() const;
+
+  // Writes a plain-text report: how often each opcode ran, which pairs of
+  // opcodes most often ran back to back (candidates for superinstructions),
+  // and the blocks of code that ran the most instructions, with function
+  // names and source lines if there's debug info.
+  void WriteReport(std::ostream &stream,
+                   const AMXDebugInfo &debug_info) const;
+
+ private:
+  // A straight run of instructions that were all executed the same number
+  // of times.
+  struct Block {
+    std::size_t first;
+    std::size_t length;
+    uint64_t executions;
+  };
+
+  // Returns true if execution doesn't always go on to the next instruction.
+  static bool IsBranch(AMXOpcode opcode);
+
+  std::vector<Block> FindBlocks() const;
+
+ private:
+  const AMXProgram &program_;
+  // One more than there are instructions, for the end-of-code sentinel.
+  std::vector<uint64_t> counts_;
+};
+
+#endif // !AMXOPCODECOUNTER_H
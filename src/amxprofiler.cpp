@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <ostream>
+#include <string>
+
+#include "amxdebuginfo.h"
+#include "amxprofiler.h"
+#include "amxstacktrace.h"
+
+AMXProfiler::AMXProfiler()
+ : num_samples_(0),
+   num_dropped_(0)
+{
+}
+
+void AMXProfiler::Sample(AMXScript amx, cell cip) {
+  Stack stack;
+  stack.num_frames = 0;
+
+  // The first frame is a fake one that returns to cip, so every frame's
+  // return address is a location in the function it belongs to.
+  AMXStackTrace trace = GetAMXStackTrace(amx, amx.GetFrm(), cip, kMaxFrames);
+  while (stack.num_frames < kMaxFrames
+         && trace.current_frame().return_address() != 0) {
+    stack.frames[stack.num_frames++] = trace.current_frame().return_address();
+    if (!trace.MoveNext()) {
+      break;
+    }
+  }
+  samples_.Push(stack);
+}
+
+void AMXProfiler::Collect() {
+  Stack stack;
+  while (samples_.Pop(stack)) {
+    counts_[std::vector<cell>(stack.frames,
+                              stack.frames + stack.num_frames)]++;
+    num_samples_++;
+  }
+  num_dropped_ += samples_.TakeDropped();
+}
+
+void AMXProfiler::WriteCollapsedStacks(std::ostream &stream,
+                                       const AMXDebugInfo &debug_info) const {
+  // Different addresses in the same functions make the same line.
+  std::map<std::string, uint64_t> lines;
+
+  for (const auto &entry : counts_) {
+    const std::vector<cell> &frames = entry.first;
+    std::string line;
+    for (std::size_t i = frames.size(); i-- > 0; ) {
+      std::string name;
+      if (debug_info.IsLoaded()) {
+        name = debug_info.GetFunctionName(frames[i]);
+      }
+      if (name.empty()) {
+        char buffer[16];
+        std::snprintf(buffer, sizeof(buffer), "0x%08X",
+                      static_cast<unsigned int>(frames[i]));
+        name = buffer;
+      }
+      if (!line.empty()) {
+        line += ';';
+      }
+      line += name;
+    }
+    lines[line] += entry.second;
+  }
+
+  for (const auto &line : lines) {
+    stream << line.first << ' ' << line.second << '\n';
+  }
+}
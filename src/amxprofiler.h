@@ -0,0 +1,60 @@
+#ifndef AMXPROFILER_H
+#define AMXPROFILER_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <vector>
+
+#include <amx/amx.h>
+
+#include "amxscript.h"
+#include "ringbuffer.h"
+
+class AMXDebugInfo;
+
+// A sampling profiler for one script. The sampler thread (see AMXSampler)
+// periodically asks the executor for a sample, and the executor calls
+// Sample() from the script's thread before the next instruction it runs,
+// so the stack is never walked while it's changing. Samples are raw code
+// addresses; they're only turned into function names when the profile is
+// written out.
+class AMXProfiler {
+ public:
+  static const int kMaxFrames = 32;
+
+  AMXProfiler();
+
+  // Records the call stack, innermost first. Called by the executor with
+  // FRM, STK and HEA up to date.
+  void Sample(AMXScript amx, cell cip);
+
+  // Counts the samples taken since the last call. Called by the sampler
+  // thread (or by anyone once the script is no longer sampled).
+  void Collect();
+
+  uint64_t num_samples() const { return num_samples_; }
+  uint64_t num_dropped() const { return num_dropped_; }
+
+  // Writes one line per distinct call stack, outermost function first, in
+  // the "collapsed" format that flame graph tools take:
+  //
+  //   OnPlayerUpdate;UpdateHUD;format_money 42
+  //
+  // Functions are named after debug info, or by code address without it.
+  void WriteCollapsedStacks(std::ostream &stream,
+                            const AMXDebugInfo &debug_info) const;
+
+ private:
+  struct Stack {
+    int num_frames;
+    cell frames[kMaxFrames];
+  };
+
+  RingBuffer<Stack, 1024> samples_;
+  std::map<std::vector<cell>, uint64_t> counts_;
+  uint64_t num_samples_;
+  uint64_t num_dropped_;
+};
+
+#endif // !AMXPROFILER_H
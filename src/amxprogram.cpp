@@ -0,0 +1,312 @@
+#include <cassert>
+#include <unordered_map>
+
+#include "amxprogram.h"
+
+namespace {
+
+const cell kNoTarget = -1;
+const int kMaxFusedLength = 5;
+
+} // anonymous namespace
+
+AMXProgram::AMXProgram() {
+}
+
+bool AMXProgram::Decode(AMXScript amx) {
+  Clear();
+
+  // Jump addresses are only absolute once amx_Init() has relocated the code.
+  if ((amx.GetFlags() & AMX_FLAG_RELOC) == 0) {
+    return false;
+  }
+
+  const AMX_HEADER *hdr = amx.GetHeader();
+  const cell *code = reinterpret_cast<const cell*>(amx.GetCode());
+  cell code_size = hdr->dat - hdr->cod;
+  cell num_cells = code_size / sizeof(cell);
+
+  // Targets are code addresses until all instructions are known.
+  std::vector<cell> targets;
+  std::vector<cell> case_targets;
+  std::unordered_map<cell, std::size_t> case_table_index;
+
+  index_.assign(num_cells + 1, -1);
+
+  for (cell i = 0; i < num_cells; ) {
+    cell address = i * sizeof(cell);
+    AMXOpcode opcode = UnrelocateAMXOpcode(code[i]);
+    AMXInstruction instruction = {code[i], 0, 0, address};
+    cell target = kNoTarget;
+    cell size = 1;
+
+    // Case tables share the "invalid" handler with other opcodes that are
+    // never executed, so recognize them by the switches pointing at them.
+    if (opcode == AMX_OP_NONE
+        && case_table_index.find(address) != case_table_index.end()) {
+      opcode = AMX_OP_CASETBL;
+    }
+
+    switch (opcode) {
+      case AMX_OP_LOAD_PRI:   // instructions with 1 parameter
+      case AMX_OP_LOAD_ALT:
+      case AMX_OP_LOAD_S_PRI:
+      case AMX_OP_LOAD_S_ALT:
+      case AMX_OP_LREF_PRI:
+      case AMX_OP_LREF_ALT:
+      case AMX_OP_LREF_S_PRI:
+      case AMX_OP_LREF_S_ALT:
+      case AMX_OP_LODB_I:
+      case AMX_OP_CONST_PRI:
+      case AMX_OP_CONST_ALT:
+      case AMX_OP_ADDR_PRI:
+      case AMX_OP_ADDR_ALT:
+      case AMX_OP_STOR_PRI:
+      case AMX_OP_STOR_ALT:
+      case AMX_OP_STOR_S_PRI:
+      case AMX_OP_STOR_S_ALT:
+      case AMX_OP_SREF_PRI:
+      case AMX_OP_SREF_ALT:
+      case AMX_OP_SREF_S_PRI:
+      case AMX_OP_SREF_S_ALT:
+      case AMX_OP_STRB_I:
+      case AMX_OP_LIDX_B:
+      case AMX_OP_IDXADDR_B:
+      case AMX_OP_ALIGN_PRI:
+      case AMX_OP_ALIGN_ALT:
+      case AMX_OP_LCTRL:
+      case AMX_OP_SCTRL:
+      case AMX_OP_PUSH_R:
+      case AMX_OP_PUSH_C:
+      case AMX_OP_PUSH:
+      case AMX_OP_PUSH_S:
+      case AMX_OP_STACK:
+      case AMX_OP_HEAP:
+      case AMX_OP_SHL_C_PRI:
+      case AMX_OP_SHL_C_ALT:
+      case AMX_OP_SHR_C_PRI:
+      case AMX_OP_SHR_C_ALT:
+      case AMX_OP_ADD_C:
+      case AMX_OP_SMUL_C:
+      case AMX_OP_ZERO:
+      case AMX_OP_ZERO_S:
+      case AMX_OP_EQ_C_PRI:
+      case AMX_OP_EQ_C_ALT:
+      case AMX_OP_INC:
+      case AMX_OP_INC_S:
+      case AMX_OP_DEC:
+      case AMX_OP_DEC_S:
+      case AMX_OP_MOVS:
+      case AMX_OP_CMPS:
+      case AMX_OP_FILL:
+      case AMX_OP_HALT:
+      case AMX_OP_BOUNDS:
+      case AMX_OP_SYSREQ_C:
+      case AMX_OP_PUSH_ADR:
+      case AMX_OP_SYMTAG:
+        size = 2;
+        break;
+      case AMX_OP_CALL:       // instructions with a relocated address
+      case AMX_OP_JUMP:
+      case AMX_OP_JZER:
+      case AMX_OP_JNZ:
+      case AMX_OP_JEQ:
+      case AMX_OP_JNEQ:
+      case AMX_OP_JLESS:
+      case AMX_OP_JLEQ:
+      case AMX_OP_JGRTR:
+      case AMX_OP_JGEQ:
+      case AMX_OP_JSLESS:
+      case AMX_OP_JSLEQ:
+      case AMX_OP_JSGRTR:
+      case AMX_OP_JSGEQ:
+      case AMX_OP_SWITCH:
+        size = 2;
+        if (i + 1 < num_cells) {
+          target = code[i + 1] - reinterpret_cast<cell>(code);
+        }
+        break;
+      case AMX_OP_JREL:
+        size = 2;
+        if (i + 1 < num_cells) {
+          target = address + 2 * sizeof(cell) + code[i + 1];
+        }
+        break;
+      case AMX_OP_FILE:
+      case AMX_OP_SYMBOL:
+        size = 2;
+        if (i + 1 < num_cells) {
+          size += code[i + 1] / sizeof(cell);
+        }
+        break;
+      case AMX_OP_LINE:
+      case AMX_OP_SRANGE:
+        size = 3;
+        break;
+      case AMX_OP_CASETBL: {
+        cell num_records = (i + 1 < num_cells) ? code[i + 1] : 0;
+        size = 3 + 2 * num_records;
+        if (i + size > num_cells) {
+          break;
+        }
+        case_table_index[address] = case_tables_.size();
+        AMXInstruction header = {0, num_records, 0, address};
+        case_tables_.push_back(header);
+        case_targets.push_back(code[i + 2] - reinterpret_cast<cell>(code));
+        for (cell j = 0; j < num_records; j++) {
+          cell record = i + 3 + 2 * j;
+          AMXInstruction entry = {
+            0, code[record], 0, static_cast<cell>(record * sizeof(cell))
+          };
+          case_tables_.push_back(entry);
+          case_targets.push_back(code[record + 1]
+                                 - reinterpret_cast<cell>(code));
+        }
+        break;
+      }
+      default:
+        // Instructions without parameters, as well as unknown opcodes. The
+        // executor aborts when it reaches the latter.
+        break;
+    }
+
+    if (size <= 0 || i + size > num_cells) {
+      break;
+    }
+    if (opcode == AMX_OP_SWITCH) {
+      case_table_index.insert(std::make_pair(target, case_tables_.size()));
+    }
+    if (target != kNoTarget) {
+      instruction.operand = target;
+    } else if (size > 1) {
+      instruction.operand = code[i + 1];
+    }
+
+    index_[i] = static_cast<int>(instructions_.size());
+    instructions_.push_back(instruction);
+    opcodes_.push_back(static_cast<unsigned char>(opcode));
+    fused_lengths_.push_back(1);
+    targets.push_back(target);
+    i += size;
+  }
+
+  // The sentinel: falling off the end of the code or jumping to a bad
+  // address lands here and aborts with AMX_ERR_INVINSTR.
+  AMXInstruction sentinel = {RelocateAMXOpcode(AMX_OP_NONE), 0, 0, code_size};
+  index_[num_cells] = static_cast<int>(instructions_.size());
+  instructions_.push_back(sentinel);
+  opcodes_.push_back(AMX_OP_NONE);
+  fused_lengths_.push_back(1);
+  AMXInstruction *end = &instructions_.back();
+  end->target = end;
+
+  for (std::size_t i = 0; i < targets.size(); i++) {
+    AMXInstruction &instruction = instructions_[i];
+    if (targets[i] == kNoTarget) {
+      continue;
+    }
+    if (opcodes_[i] == AMX_OP_SWITCH) {
+      std::unordered_map<cell, std::size_t>::const_iterator iterator =
+        case_table_index.find(targets[i]);
+      if (iterator != case_table_index.end()
+          && iterator->second < case_tables_.size()
+          && case_tables_[iterator->second].address == targets[i]) {
+        instruction.target = &case_tables_[iterator->second];
+      } else {
+        instruction.target = end;
+      }
+    } else {
+      AMXInstruction *target = Find(targets[i]);
+      instruction.target = (target != 0) ? target : end;
+    }
+  }
+  for (std::size_t i = 0; i < case_targets.size(); i++) {
+    AMXInstruction *target = Find(case_targets[i]);
+    case_tables_[i].target = (target != 0) ? target : end;
+  }
+
+  return true;
+}
+
+void AMXProgram::Clear() {
+  instructions_.clear();
+  case_tables_.clear();
+  opcodes_.clear();
+  fused_lengths_.clear();
+  index_.clear();
+}
+
+const AMXInstruction *AMXProgram::Find(cell address) const {
+  if (address < 0 || address % sizeof(cell) != 0) {
+    return 0;
+  }
+  std::size_t i = address / sizeof(cell);
+  if (i >= index_.size() || index_[i] < 0) {
+    return 0;
+  }
+  return &instructions_[index_[i]];
+}
+
+const AMXInstruction *AMXProgram::FindPrevious(cell address) const {
+  const AMXInstruction *instruction = Find(address);
+  if (instruction == 0 || instruction == begin()) {
+    return 0;
+  }
+  return instruction - 1;
+}
+
+cell AMXProgram::GetNextAddress(cell address) const {
+  const AMXInstruction *instruction = Find(address);
+  if (instruction == 0 || instruction == end()) {
+    return -1;
+  }
+  return (instruction + 1)->address;
+}
+
+AMXOpcode AMXProgram::GetOpcode(const AMXInstruction *instruction) const {
+  assert(instruction >= begin() && instruction <= end());
+  return static_cast<AMXOpcode>(opcodes_[instruction - begin()]);
+}
+
+void AMXProgram::Fuse(AMXInstruction *first, int count, cell handler) {
+  assert(first >= begin() && first + count <= end());
+  assert(count > 1 && count <= kMaxFusedLength);
+  first->handler = handler;
+  fused_lengths_[first - begin()] = static_cast<unsigned char>(count);
+}
+
+void AMXProgram::Unfuse(AMXInstruction *first) {
+  assert(first >= begin() && first < end());
+  first->handler = RelocateAMXOpcode(GetOpcode(first));
+  fused_lengths_[first - begin()] = 1;
+}
+
+bool AMXProgram::UnfuseAt(cell address) {
+  AMXInstruction *instruction = Find(address);
+  if (instruction == 0) {
+    return false;
+  }
+  for (int i = 0; i < kMaxFusedLength && instruction - i >= begin(); i++) {
+    AMXInstruction *first = instruction - i;
+    int length = GetFusedLength(first);
+    if (length > 1 && length > i) {
+      Unfuse(first);
+      return true;
+    }
+  }
+  return false;
+}
+
+void AMXProgram::UnfuseAll() {
+  for (AMXInstruction *instruction = begin(); instruction != end();
+       instruction++) {
+    if (GetFusedLength(instruction) > 1) {
+      Unfuse(instruction);
+    }
+  }
+}
+
+int AMXProgram::GetFusedLength(const AMXInstruction *instruction) const {
+  assert(instruction >= begin() && instruction <= end());
+  return fused_lengths_[instruction - begin()];
+}
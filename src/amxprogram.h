@@ -0,0 +1,104 @@
+#ifndef AMXPROGRAM_H
+#define AMXPROGRAM_H
+
+#include <vector>
+
+#include <amx/amx.h>
+
+#include "amxopcode.h"
+#include "amxscript.h"
+
+// One decoded instruction. Jumps, calls and switches have their destination
+// resolved to another instruction (for a switch that's the header of its case
+// table), so the executor never has to parse the code or translate addresses
+// on the fast path.
+struct AMXInstruction {
+  cell handler;            // relocated opcode, as stored in the code
+  cell operand;            // first parameter (jump target address for jumps)
+  AMXInstruction *target;  // resolved jump/call/switch target
+  cell address;            // code address of the original instruction
+};
+
+// Pre-decoded copy of a script's code section. Instructions are laid out in
+// code order followed by a sentinel that marks the end of the code and that
+// invalid jumps are resolved to. Case tables are stored separately as a
+// header (number of records, default target) followed by the records
+// (value, target).
+//
+// The code is decoded once after amx_Init(); scripts that patch their own
+// code at run time won't see the changes. Instructions may later be fused
+// into superinstructions; every instruction keeps its own address and
+// opcode either way.
+class AMXProgram {
+ public:
+  AMXProgram();
+
+  bool Decode(AMXScript amx);
+  void Clear();
+
+  bool IsEmpty() const { return instructions_.empty(); }
+
+  AMXInstruction *begin() { return instructions_.data(); }
+  AMXInstruction *end() { return begin() + num_instructions(); }
+
+  const AMXInstruction *begin() const { return instructions_.data(); }
+  const AMXInstruction *end() const { return begin() + num_instructions(); }
+
+  // Number of instructions, not counting the sentinel.
+  std::size_t num_instructions() const {
+    return instructions_.empty() ? 0 : instructions_.size() - 1;
+  }
+
+  // Returns the instruction that starts at the specified address, or null if
+  // there's no such instruction.
+  AMXInstruction *Find(cell address) {
+    return const_cast<AMXInstruction*>(const_this()->Find(address));
+  }
+  const AMXInstruction *Find(cell address) const;
+
+  // Returns the instruction that ends right before the specified address,
+  // e.g. the instruction that was executing when CIP was saved.
+  const AMXInstruction *FindPrevious(cell address) const;
+
+  bool IsInstructionBoundary(cell address) const {
+    return Find(address) != 0;
+  }
+
+  // Returns the address of the instruction that follows the one at the
+  // specified address, or -1 if it's not an instruction boundary.
+  cell GetNextAddress(cell address) const;
+
+  AMXOpcode GetOpcode(const AMXInstruction *instruction) const;
+
+  // Gives the first of count instructions a handler that executes all of
+  // them (a superinstruction). The rest are left intact so that jumps into
+  // the middle of the sequence still work.
+  void Fuse(AMXInstruction *first, int count, cell handler);
+
+  // Restores the original handler of a fused sequence.
+  void Unfuse(AMXInstruction *first);
+
+  // Undoes the fusion that covers the instruction at the specified address,
+  // so that execution can be stopped right before it. Returns false if the
+  // instruction isn't part of a superinstruction.
+  bool UnfuseAt(cell address);
+  void UnfuseAll();
+
+  // Returns how many instructions the instruction executes: more than one
+  // for the head of a superinstruction, otherwise one.
+  int GetFusedLength(const AMXInstruction *instruction) const;
+
+ private:
+  const AMXProgram *const_this() const {
+    return const_cast<const AMXProgram*>(this);
+  }
+
+ private:
+  std::vector<AMXInstruction> instructions_;
+  std::vector<AMXInstruction> case_tables_;
+  std::vector<unsigned char> opcodes_;
+  std::vector<unsigned char> fused_lengths_;
+  std::vector<int> index_;
+};
+
+#endif // !AMXPROGRAM_H
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <chrono>
+
+#include "amxexecutor.h"
+#include "amxprofiler.h"
+#include "amxsampler.h"
+
+AMXSampler::AMXSampler()
+ : stop_(false)
+{
+}
+
+AMXSampler::~AMXSampler() {
+  Stop();
+}
+
+void AMXSampler::Start(int rate) {
+  if (rate <= 0 || thread_.joinable()) {
+    return;
+  }
+  stop_ = false;
+  thread_ = std::thread(&AMXSampler::Run, this, rate);
+}
+
+void AMXSampler::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void AMXSampler::Add(AMXExecutor *executor, AMXProfiler *profiler) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  scripts_.push_back(std::make_pair(executor, profiler));
+}
+
+void AMXSampler::Remove(AMXExecutor *executor) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  scripts_.erase(
+    std::remove_if(scripts_.begin(), scripts_.end(),
+      [executor](const std::pair<AMXExecutor*, AMXProfiler*> &script) {
+        return script.first == executor;
+      }),
+    scripts_.end());
+}
+
+void AMXSampler::Run(int rate) {
+  std::chrono::steady_clock::duration interval =
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(1.0 / rate));
+  std::chrono::steady_clock::time_point next_tick =
+    std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    // Ticks are scheduled ahead of time so that the rate doesn't drift
+    // with the time spent counting.
+    next_tick = std::max(next_tick + interval,
+                         std::chrono::steady_clock::now());
+    if (stop_condition_.wait_until(lock, next_tick, [this] { return stop_; })) {
+      break;
+    }
+    for (std::size_t i = 0; i < scripts_.size(); i++) {
+      scripts_[i].second->Collect();
+      scripts_[i].first->EnableFlags(AMXExecutor::EXEC_SAMPLE);
+    }
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef AMXSAMPLER_H
+#define AMXSAMPLER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class AMXExecutor;
+class AMXProfiler;
+
+// Drives the sampling profilers of all scripts from one thread. At every
+// tick it counts the samples taken since the last one and asks each
+// script's executor for another. A script that isn't running at the time
+// ignores the request (see AMXExecutor::EXEC_SAMPLE), so time spent outside
+// of Pawn code isn't attributed to anything.
+class AMXSampler {
+ public:
+  AMXSampler();
+  ~AMXSampler();
+
+  // Takes about rate samples per second from each script.
+  void Start(int rate);
+  void Stop();
+
+  // The profiler is no longer touched once Remove() returns.
+  void Add(AMXExecutor *executor, AMXProfiler *profiler);
+  void Remove(AMXExecutor *executor);
+
+ private:
+  void Run(int rate);
+
+ private:
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable stop_condition_;
+  bool stop_;
+  std::vector<std::pair<AMXExecutor*, AMXProfiler*>> scripts_;
+};
+
+#endif // !AMXSAMPLER_H
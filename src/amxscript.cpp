@@ -22,8 +22,7 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
-#include <cstring>
-
+#include "amxnameindex.h"
 #include "amxscript.h"
 
 AMXScript::AMXScript(AMX *amx)
@@ -62,25 +61,13 @@ const AMX_FUNCSTUBNT *AMXScript::GetPublics() const {
 }
 
 const char *AMXScript::FindPublic(cell address) const {
-  const AMX_FUNCSTUBNT *publics = GetPublics();
-  int n = GetNumPublics();
-  for (int i = 0; i < n; i++) {
-    if (publics[i].address == static_cast<ucell>(address)) {
-      return GetName(publics[i].nameofs);
-    }
-  }
-  return 0;
+  int index = AMXNameIndex::GetInstance(amx_)->FindPublic(address);
+  return index >= 0 ? GetPublicName(index) : 0;
 }
 
 const char *AMXScript::FindNative(cell address) const {
-  const AMX_FUNCSTUBNT *natives = GetNatives();
-  int n = GetNumNatives();
-  for (int i = 0; i < n; i++) {
-    if (natives[i].address == static_cast<ucell>(address)) {
-      return GetName(natives[i].nameofs);
-    }
-  }
-  return 0;
+  int index = AMXNameIndex::GetInstance(amx_)->FindNative(address);
+  return index >= 0 ? GetNativeName(index) : 0;
 }
 
 int AMXScript::GetNumNatives() const {
@@ -94,25 +81,11 @@ int AMXScript::GetNumPublics() const {
 }
 
 cell AMXScript::GetNativeIndex(const char *name) const {
-  int n = GetNumNatives();
-  const AMX_FUNCSTUBNT *natives = GetNatives();
-  for (int i = 0; i < n; i++) {
-    if (std::strcmp(GetName(natives[i].nameofs), name) == 0) {
-      return i;
-    }
-  }
-  return -1;
+  return AMXNameIndex::GetInstance(amx_)->GetNativeIndex(name);
 }
 
 cell AMXScript::GetPublicIndex(const char *name) const {
-  int n = GetNumPublics();
-  const AMX_FUNCSTUBNT *publics = GetPublics();
-  for (int i = 0; i < n; i++) {
-    if (std::strcmp(GetName(publics[i].nameofs), name) == 0) {
-      return i;
-    }
-  }
-  return -1;
+  return AMXNameIndex::GetInstance(amx_)->GetPublicIndex(name);
 }
 
 cell AMXScript::GetNativeAddress(int index) const {
@@ -168,6 +141,16 @@ bool AMXScript::IsStackOK() const {
   return GetStk() >= GetHlw() && GetStk() <= GetStp();
 }
 
+bool AMXScript::IsValidDataRange(cell address, cell ncells) const {
+  if (address < 0 || ncells < 0 || address % sizeof(cell) != 0) {
+    return false;
+  }
+  // Compare in 64 bits so that a huge ncells can't wrap around.
+  int64_t start = address;
+  int64_t end = start + static_cast<int64_t>(ncells) * sizeof(cell);
+  return end <= GetHea() || (start >= GetStk() && end <= GetStp());
+}
+
 void AMXScript::PushStack(cell value) {
   amx_->stk -= sizeof(cell);
   *reinterpret_cast<cell*>(GetData() + amx_->stk) = value;
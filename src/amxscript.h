@@ -123,6 +123,11 @@ class AMXScript {
   cell GetStackSpaceLeft() const;
   bool IsStackOK() const;
 
+  // Checks that ncells cells starting at address (relative to the data
+  // section) are in use: either in the data section and the heap, or on
+  // the stack.
+  bool IsValidDataRange(cell address, cell ncells) const;
+
   void PushStack(cell value);
   cell PopStack();
   void PopStack(int ncells);
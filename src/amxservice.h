@@ -25,10 +25,9 @@
 #ifndef AMXSERVICE_H
 #define AMXSERVICE_H
 
-#include <map>
-
 #include <amx/amx.h>
 
+#include "amxinstancemap.h"
 #include "amxscript.h"
 
 template<typename T>
@@ -40,47 +39,54 @@ class AMXService {
 
  public:
   static T *CreateInstance(AMXScript amx);
+
+  // Returns the existing instance or creates a new one. The lookup is
+  // lock-free, see AMXInstanceMap.
   static T *GetInstance(AMXScript amx);
+
+  // Same but returns null if there's no instance.
+  static T *FindInstance(AMXScript amx);
+
   static void DestroyInstance(AMXScript amx);
 
  private:
   AMXScript amx_;
 
  private:
-  typedef std::map<AMX*, T*> ServiceMap;
-  static ServiceMap service_map_;
+  static AMXInstanceMap<T> instances_;
 };
 
 template<typename T>
-typename AMXService<T>::ServiceMap AMXService<T>::service_map_;
+AMXInstanceMap<T> AMXService<T>::instances_;
 
 // static
 template<typename T>
 T *AMXService<T>::CreateInstance(AMXScript amx) {
   T *service = new T(amx);
-  service_map_.insert(std::make_pair(amx, service));
+  instances_.Insert(amx, service);
   return service;
 }
 
 // static
 template<typename T>
 T *AMXService<T>::GetInstance(AMXScript amx) {
-  typename ServiceMap::const_iterator iterator = service_map_.find(amx);
-  if (iterator != service_map_.end()) {
-    return iterator->second;
+  T *service = instances_.Find(amx);
+  if (service != 0) {
+    return service;
   }
   return CreateInstance(amx);
 }
 
+// static
+template<typename T>
+T *AMXService<T>::FindInstance(AMXScript amx) {
+  return instances_.Find(amx);
+}
+
 // static
 template<typename T>
 void AMXService<T>::DestroyInstance(AMXScript amx) {
-  typename ServiceMap::iterator iterator = service_map_.find(amx);
-  if (iterator != service_map_.end()) {
-    T *service = iterator->second;
-    service_map_.erase(iterator);
-    delete service;
-  }
+  delete instances_.Remove(amx);
 }
 
 #endif // !AMXSERVICE_H
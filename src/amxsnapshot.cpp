@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cstring>
+
+#include "amxdebuginfo.h"
+#include "amxsnapshot.h"
+#include "amxstacktrace.h"
+
+namespace {
+
+typedef void (Response::Registers::*RegisterSetter)(::google::protobuf::int32);
+
+// In field number order, so that bit n of changed_registers is field n + 1.
+const RegisterSetter register_setters[] = {
+  &Response::Registers::set_pri,
+  &Response::Registers::set_alt,
+  &Response::Registers::set_cod,
+  &Response::Registers::set_dat,
+  &Response::Registers::set_hlw,
+  &Response::Registers::set_hea,
+  &Response::Registers::set_stp,
+  &Response::Registers::set_stk,
+  &Response::Registers::set_frm,
+  &Response::Registers::set_cip
+};
+
+} // anonymous namespace
+
+AMXSnapshot::AMXSnapshot()
+ : valid_(false)
+{
+  std::fill(registers_, registers_ + kNumRegisters, 0);
+}
+
+bool AMXSnapshot::AddWatch(cell address, cell ncells) {
+  if (address < 0 || address % sizeof(cell) != 0 || ncells <= 0) {
+    return false;
+  }
+  Watch watch;
+  watch.address = address;
+  watch.ncells = ncells;
+  watches_.push_back(watch);
+  return true;
+}
+
+bool AMXSnapshot::RemoveWatch(cell address, cell ncells) {
+  for (std::vector<Watch>::iterator iterator = watches_.begin();
+       iterator != watches_.end(); iterator++) {
+    if (iterator->address == address && iterator->ncells == ncells) {
+      watches_.erase(iterator);
+      return true;
+    }
+  }
+  return false;
+}
+
+void AMXSnapshot::Reset() {
+  valid_ = false;
+  for (std::size_t i = 0; i < watches_.size(); i++) {
+    watches_[i].values.clear();
+  }
+}
+
+void AMXSnapshot::Clear() {
+  valid_ = false;
+  watches_.clear();
+  frames_.clear();
+  std::vector<unsigned char>().swap(memory_);
+}
+
+void AMXSnapshot::Update(AMXScript amx, Response::Snapshot *snapshot) {
+  // A new stack size means a different script image; start over.
+  bool full = !valid_ || memory_.size() != static_cast<std::size_t>(amx.GetStp());
+  snapshot->set_full(full);
+
+  UpdateRegisters(amx, snapshot, full);
+  UpdateFrames(amx, snapshot, full);
+  UpdateWatches(amx, snapshot);
+
+  const unsigned char *data = amx.GetData();
+  if (full) {
+    memory_.assign(data, data + amx.GetStp());
+  } else {
+    // The gap between the heap and the stack is garbage, don't bother.
+    UpdatePages(amx, snapshot, 0, amx.GetHea());
+    UpdatePages(amx, snapshot, amx.GetStk(), amx.GetStp());
+  }
+
+  valid_ = true;
+}
+
+void AMXSnapshot::UpdateRegisters(AMXScript amx,
+                                  Response::Snapshot *snapshot,
+                                  bool full) {
+  const AMX_HEADER *header = amx.GetHeader();
+  cell registers[kNumRegisters] = {
+    amx.GetPri(),
+    amx.GetAlt(),
+    header->cod,
+    header->dat,
+    amx.GetHlw(),
+    amx.GetHea(),
+    amx.GetStp(),
+    amx.GetStk(),
+    amx.GetFrm(),
+    amx.GetCip()
+  };
+
+  uint32_t changed = 0;
+  for (int i = 0; i < kNumRegisters; i++) {
+    if (full || registers[i] != registers_[i]) {
+      changed |= 1u << i;
+      (snapshot->mutable_registers()->*register_setters[i])(registers[i]);
+      registers_[i] = registers[i];
+    }
+  }
+  snapshot->set_changed_registers(changed);
+}
+
+void AMXSnapshot::UpdateFrames(AMXScript amx,
+                               Response::Snapshot *snapshot,
+                               bool full) {
+  std::vector<cell> frames;
+  frames.reserve(kMaxFrames * 3);
+
+  AMXStackTrace trace =
+    GetAMXStackTrace(amx, amx.GetFrm(), amx.GetCip(), kMaxFrames);
+  while (trace.current_frame().return_address() != 0) {
+    const AMXStackFrame &frame = trace.current_frame();
+    frames.push_back(frame.address());
+    frames.push_back(frame.return_address());
+    frames.push_back(frame.caller_address());
+    if (!trace.MoveNext()) {
+      break;
+    }
+  }
+
+  if (!full && frames == frames_) {
+    return;
+  }
+  snapshot->set_frames_changed(true);
+  for (std::size_t i = 0; i < frames.size(); i += 3) {
+    Response::Snapshot::Frame *frame = snapshot->add_frames();
+    frame->set_address(frames[i]);
+    frame->set_return_address(frames[i + 1]);
+    frame->set_function(frames[i + 2]);
+  }
+  frames_.swap(frames);
+}
+
+void AMXSnapshot::UpdateWatches(AMXScript amx, Response::Snapshot *snapshot) {
+  for (std::size_t i = 0; i < watches_.size(); i++) {
+    Watch &watch = watches_[i];
+
+    // Stack variables come and go. Forget what they held so that they're
+    // reported in full once they're back.
+    if (!amx.IsValidDataRange(watch.address, watch.ncells)) {
+      watch.values.clear();
+      continue;
+    }
+    const cell *values =
+      reinterpret_cast<const cell*>(amx.GetData() + watch.address);
+
+    if (watch.values.empty()) {
+      Response::Memory *memory = snapshot->add_watches();
+      memory->set_address(watch.address);
+      memory->mutable_values()->Reserve(watch.ncells);
+      for (cell j = 0; j < watch.ncells; j++) {
+        memory->add_values(values[j]);
+      }
+      watch.values.assign(values, values + watch.ncells);
+      continue;
+    }
+
+    // Send each run of changed cells as a separate range.
+    Response::Memory *memory = 0;
+    for (cell j = 0; j < watch.ncells; j++) {
+      if (values[j] == watch.values[j]) {
+        memory = 0;
+        continue;
+      }
+      if (memory == 0) {
+        memory = snapshot->add_watches();
+        memory->set_address(watch.address + j * sizeof(cell));
+      }
+      memory->add_values(values[j]);
+      watch.values[j] = values[j];
+    }
+  }
+}
+
+void AMXSnapshot::UpdatePages(AMXScript amx,
+                              Response::Snapshot *snapshot,
+                              cell start,
+                              cell end) {
+  const unsigned char *data = amx.GetData();
+  for (cell page_start = start - start % kPageSize;
+       page_start < end;
+       page_start += kPageSize) {
+    cell from = std::max(page_start, start);
+    cell to = std::min(page_start + kPageSize, end);
+    if (std::memcmp(data + from, &memory_[from], to - from) == 0) {
+      continue;
+    }
+    std::memcpy(&memory_[from], data + from, to - from);
+
+    // The heap and the stack can meet in the same page.
+    uint32_t page = static_cast<uint32_t>(page_start / kPageSize);
+    int n = snapshot->dirty_pages_size();
+    if (n == 0 || snapshot->dirty_pages(n - 1) != page) {
+      snapshot->add_dirty_pages(page);
+    }
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef AMXSNAPSHOT_H
+#define AMXSNAPSHOT_H
+
+#include <cstddef>
+#include <vector>
+
+#include <amx/amx.h>
+
+#include "amxscript.h"
+#include "proto/response.pb.h"
+
+// What the debugger was last told about a stopped script, so that the next
+// stop only has to tell it what changed: registers, the top of the call
+// stack, watched memory ranges and which pages of the data section, heap
+// and stack were written to. Changed pages are found by comparing against a
+// shadow copy; their contents aren't sent, the debugger reads the ones it
+// cares about with MEMORY_READ.
+//
+// Only used on the script's thread, while it's stopped.
+class AMXSnapshot {
+ public:
+  static const cell kPageSize = 4096;
+  static const int kMaxFrames = 8;
+
+  AMXSnapshot();
+
+  // Watched ranges are sent in full with the next snapshot and then
+  // whenever they change.
+  bool AddWatch(cell address, cell ncells);
+  bool RemoveWatch(cell address, cell ncells);
+
+  // Makes the next snapshot a full one, e.g. for a newly connected client.
+  void Reset();
+
+  // Also forgets the watches and frees the shadow copy.
+  void Clear();
+
+  // Fills snapshot with what changed since the last call and remembers the
+  // current state.
+  void Update(AMXScript amx, Response::Snapshot *snapshot);
+
+ private:
+  static const int kNumRegisters = 10;
+
+  struct Watch {
+    cell address;
+    cell ncells;
+    std::vector<cell> values; // empty until first sent
+  };
+
+  void UpdateRegisters(AMXScript amx, Response::Snapshot *snapshot, bool full);
+  void UpdateFrames(AMXScript amx, Response::Snapshot *snapshot, bool full);
+  void UpdateWatches(AMXScript amx, Response::Snapshot *snapshot);
+  void UpdatePages(AMXScript amx, Response::Snapshot *snapshot,
+                   cell start, cell end);
+
+ private:
+  bool valid_;
+  cell registers_[kNumRegisters];
+  std::vector<cell> frames_; // address, return address, function
+  std::vector<Watch> watches_;
+  std::vector<unsigned char> memory_;
+};
+
+#endif // !AMXSNAPSHOT_H
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <chrono>
+
+#include "amxexecutor.h"
+#include "amxwatchdog.h"
+
+AMXWatchdog::AMXWatchdog()
+ : stop_(false)
+{
+}
+
+AMXWatchdog::~AMXWatchdog() {
+  Stop();
+}
+
+void AMXWatchdog::Start(int timeout) {
+  if (timeout <= 0 || thread_.joinable()) {
+    return;
+  }
+  stop_ = false;
+  thread_ = std::thread(&AMXWatchdog::Run, this, timeout);
+}
+
+void AMXWatchdog::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void AMXWatchdog::Add(AMXExecutor *executor,
+                      const std::atomic<int64_t> *callback_start) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Script script = {executor, callback_start, 0};
+  scripts_.push_back(script);
+}
+
+void AMXWatchdog::Remove(AMXExecutor *executor) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  scripts_.erase(
+    std::remove_if(scripts_.begin(), scripts_.end(),
+      [executor](const Script &script) {
+        return script.executor == executor;
+      }),
+    scripts_.end());
+}
+
+void AMXWatchdog::Run(int timeout) {
+  // Checking a few times per timeout is close enough: the backtrace shows
+  // where the callback was at some point after it went over, not when.
+  std::chrono::nanoseconds limit = std::chrono::milliseconds(timeout);
+  std::chrono::nanoseconds interval =
+    std::max<std::chrono::nanoseconds>(limit / 4, std::chrono::milliseconds(1));
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (stop_condition_.wait_for(lock, interval, [this] { return stop_; })) {
+      break;
+    }
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+    for (std::size_t i = 0; i < scripts_.size(); i++) {
+      Script &script = scripts_[i];
+      int64_t start = script.callback_start->load(std::memory_order_relaxed);
+      if (start != 0
+          && start != script.reported_start
+          && now - start >= limit.count()) {
+        script.reported_start = start;
+        script.executor->EnableFlags(AMXExecutor::EXEC_BACKTRACE);
+      }
+    }
+  }
+}
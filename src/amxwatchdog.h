@@ -0,0 +1,51 @@
+#ifndef AMXWATCHDOG_H
+#define AMXWATCHDOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class AMXExecutor;
+
+// Keeps an eye on the callbacks of all scripts from one thread. Each script
+// publishes when its outermost callback started (0 while it's not in one);
+// once a callback has run for longer than the timeout, the watchdog asks the
+// script's executor for a backtrace (see AMXExecutor::EXEC_BACKTRACE), so
+// that the report of the slow callback can tell where it was spending its
+// time. Asks once per callback.
+class AMXWatchdog {
+ public:
+  AMXWatchdog();
+  ~AMXWatchdog();
+
+  // Callback start times are in nanoseconds of std::chrono::steady_clock,
+  // the timeout is in milliseconds.
+  void Start(int timeout);
+  void Stop();
+
+  // The start time is no longer read once Remove() returns.
+  void Add(AMXExecutor *executor,
+           const std::atomic<int64_t> *callback_start);
+  void Remove(AMXExecutor *executor);
+
+ private:
+  void Run(int timeout);
+
+ private:
+  struct Script {
+    AMXExecutor *executor;
+    const std::atomic<int64_t> *callback_start;
+    int64_t reported_start;
+  };
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable stop_condition_;
+  bool stop_;
+  std::vector<Script> scripts_;
+};
+
+#endif // !AMXWATCHDOG_H
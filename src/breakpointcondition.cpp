@@ -0,0 +1,222 @@
+#include <cstring>
+
+#include "breakpointcondition.h"
+
+BreakpointCondition::BreakpointCondition()
+ : is_tracepoint_(false),
+   hit_count_(1),
+   every_(1),
+   hits_(0)
+{
+}
+
+bool BreakpointCondition::Compile(const Task::Breakpoint &breakpoint,
+                                  const AMXDebugInfo &debug_info) {
+  comparisons_.clear();
+  comparisons_.reserve(breakpoint.conditions_size());
+  captures_.clear();
+
+  for (int i = 0; i < breakpoint.conditions_size(); i++) {
+    const Task::Breakpoint::Comparison &condition = breakpoint.conditions(i);
+
+    if (!Task::Breakpoint::Comparison::Operator_IsValid(condition.op())) {
+      return false;
+    }
+
+    Comparison comparison;
+    comparison.op = static_cast<uint8_t>(condition.op());
+    comparison.is_float = condition.is_float();
+    comparison.value = condition.value();
+    if (!CompileOperand(condition.operand(),
+                        condition.variable(),
+                        condition.address(),
+                        breakpoint,
+                        debug_info,
+                        comparison.operand,
+                        comparison.is_float)) {
+      return false;
+    }
+    comparisons_.push_back(comparison);
+  }
+
+  if (breakpoint.captures_size() > TraceRecord::kMaxValues) {
+    return false;
+  }
+  captures_.reserve(breakpoint.captures_size());
+
+  for (int i = 0; i < breakpoint.captures_size(); i++) {
+    const Task::Breakpoint::Capture &capture = breakpoint.captures(i);
+
+    Operand operand;
+    bool is_float = false;
+    if (!CompileOperand(capture.operand(),
+                        capture.variable(),
+                        capture.address(),
+                        breakpoint,
+                        debug_info,
+                        operand,
+                        is_float)) {
+      return false;
+    }
+    captures_.push_back(operand);
+  }
+
+  is_tracepoint_ = breakpoint.trace();
+  hit_count_ = breakpoint.hit_count() > 0 ? breakpoint.hit_count() : 1;
+  every_ = breakpoint.every() > 0 ? breakpoint.every() : 1;
+  hits_ = 0;
+  return true;
+}
+
+bool BreakpointCondition::Check(AMXScript amx) {
+  for (std::size_t i = 0; i < comparisons_.size(); i++) {
+    if (!Evaluate(comparisons_[i], amx)) {
+      return false;
+    }
+  }
+  hits_++;
+  return hits_ >= hit_count_ && (hits_ - hit_count_) % every_ == 0;
+}
+
+void BreakpointCondition::Capture(AMXScript amx, TraceRecord &record) const {
+  record.num_values = static_cast<int>(captures_.size());
+  for (std::size_t i = 0; i < captures_.size(); i++) {
+    if (!ReadOperand(captures_[i], amx, record.values[i])) {
+      record.values[i] = 0;
+    }
+  }
+}
+
+// static
+bool BreakpointCondition::CompileOperand(
+    Task::Breakpoint::Comparison::Operand kind,
+    const std::string &variable,
+    cell address,
+    const Task::Breakpoint &breakpoint,
+    const AMXDebugInfo &debug_info,
+    Operand &operand,
+    bool &is_float) {
+  operand.operand = 0;
+
+  switch (kind) {
+    case Task::Breakpoint::Comparison::PRI:
+      operand.source = SOURCE_PRI;
+      return true;
+    case Task::Breakpoint::Comparison::ALT:
+      operand.source = SOURCE_ALT;
+      return true;
+    case Task::Breakpoint::Comparison::FRM:
+      operand.source = SOURCE_FRM;
+      return true;
+    case Task::Breakpoint::Comparison::STK:
+      operand.source = SOURCE_STK;
+      return true;
+    case Task::Breakpoint::Comparison::HEA:
+      operand.source = SOURCE_HEA;
+      return true;
+    case Task::Breakpoint::Comparison::CELL:
+      operand.source = SOURCE_DATA;
+      operand.operand = address;
+      return true;
+    case Task::Breakpoint::Comparison::VARIABLE: {
+      if (!debug_info.IsLoaded()) {
+        return false;
+      }
+      AMXDebugSymbol symbol = debug_info.GetVariable(
+        variable, breakpoint.instruction_pointer());
+      if (!symbol || !(symbol.IsVariable() || symbol.IsReference())) {
+        return false;
+      }
+      if (symbol.IsLocal()) {
+        operand.source = symbol.IsReference() ? SOURCE_FRAME_REF
+                                              : SOURCE_FRAME;
+      } else {
+        operand.source = symbol.IsReference() ? SOURCE_DATA_REF
+                                              : SOURCE_DATA;
+      }
+      operand.operand = symbol.GetAddress();
+      if (debug_info.GetTagName(symbol.GetTag()) == "Float") {
+        is_float = true;
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+// static
+bool BreakpointCondition::ReadOperand(const Operand &operand,
+                                      AMXScript amx,
+                                      cell &value) {
+  cell address;
+
+  switch (operand.source) {
+    case SOURCE_PRI:
+      value = amx.GetPri();
+      return true;
+    case SOURCE_ALT:
+      value = amx.GetAlt();
+      return true;
+    case SOURCE_FRM:
+      value = amx.GetFrm();
+      return true;
+    case SOURCE_STK:
+      value = amx.GetStk();
+      return true;
+    case SOURCE_HEA:
+      value = amx.GetHea();
+      return true;
+  }
+
+  address = operand.operand;
+  if (operand.source == SOURCE_FRAME || operand.source == SOURCE_FRAME_REF) {
+    address += amx.GetFrm();
+  }
+  if (operand.source == SOURCE_DATA_REF
+      || operand.source == SOURCE_FRAME_REF) {
+    if (!amx.IsValidDataRange(address, 1)) {
+      return false;
+    }
+    address = *reinterpret_cast<const cell*>(amx.GetData() + address);
+  }
+  if (!amx.IsValidDataRange(address, 1)) {
+    return false;
+  }
+  value = *reinterpret_cast<const cell*>(amx.GetData() + address);
+  return true;
+}
+
+// static
+bool BreakpointCondition::Evaluate(const Comparison &comparison,
+                                   AMXScript amx) {
+  cell value;
+  if (!ReadOperand(comparison.operand, amx, value)) {
+    return false;
+  }
+
+  if (comparison.is_float) {
+    float left, right;
+    std::memcpy(&left, &value, sizeof(left));
+    std::memcpy(&right, &comparison.value, sizeof(right));
+    switch (comparison.op) {
+      case Task::Breakpoint::Comparison::EQ: return left == right;
+      case Task::Breakpoint::Comparison::NE: return left != right;
+      case Task::Breakpoint::Comparison::LT: return left < right;
+      case Task::Breakpoint::Comparison::LE: return left <= right;
+      case Task::Breakpoint::Comparison::GT: return left > right;
+      case Task::Breakpoint::Comparison::GE: return left >= right;
+    }
+    return false;
+  }
+
+  switch (comparison.op) {
+    case Task::Breakpoint::Comparison::EQ: return value == comparison.value;
+    case Task::Breakpoint::Comparison::NE: return value != comparison.value;
+    case Task::Breakpoint::Comparison::LT: return value < comparison.value;
+    case Task::Breakpoint::Comparison::LE: return value <= comparison.value;
+    case Task::Breakpoint::Comparison::GT: return value > comparison.value;
+    case Task::Breakpoint::Comparison::GE: return value >= comparison.value;
+  }
+  return false;
+}
@@ -0,0 +1,82 @@
+#ifndef BREAKPOINTCONDITION_H
+#define BREAKPOINTCONDITION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <amx/amx.h>
+
+#include "amxdebuginfo.h"
+#include "amxscript.h"
+#include "tracebuffer.h"
+#include "proto/task.pb.h"
+
+// The condition of a breakpoint, compiled from BREAKPOINT_ADD into a list of
+// comparisons that can be checked without looking anything up: variables
+// are resolved to an address (or a frame offset) once, when the breakpoint
+// is set. The same goes for what a tracepoint captures.
+class BreakpointCondition {
+ public:
+  BreakpointCondition();
+
+  // Returns false if a comparison or a capture names a variable that isn't
+  // visible at the breakpoint or isn't a single cell, or if there are too
+  // many captures.
+  bool Compile(const Task::Breakpoint &breakpoint,
+               const AMXDebugInfo &debug_info);
+
+  // Counts a hit and tells whether the script should stop (or, for a
+  // tracepoint, whether to record it).
+  bool Check(AMXScript amx);
+
+  bool is_tracepoint() const { return is_tracepoint_; }
+
+  // Fills in num_values and values. Cells that can't be read are 0.
+  void Capture(AMXScript amx, TraceRecord &record) const;
+
+ private:
+  enum Source {
+    SOURCE_PRI,
+    SOURCE_ALT,
+    SOURCE_FRM,
+    SOURCE_STK,
+    SOURCE_HEA,
+    SOURCE_DATA,      // cell at operand
+    SOURCE_FRAME,     // cell at FRM + operand
+    SOURCE_DATA_REF,  // cell that the cell at operand points to
+    SOURCE_FRAME_REF  // cell that the cell at FRM + operand points to
+  };
+
+  struct Operand {
+    uint8_t source;
+    cell operand;
+  };
+
+  struct Comparison {
+    Operand operand;
+    uint8_t op;
+    bool is_float;
+    cell value;
+  };
+
+  static bool CompileOperand(Task::Breakpoint::Comparison::Operand kind,
+                             const std::string &variable,
+                             cell address,
+                             const Task::Breakpoint &breakpoint,
+                             const AMXDebugInfo &debug_info,
+                             Operand &operand,
+                             bool &is_float);
+  static bool ReadOperand(const Operand &operand, AMXScript amx, cell &value);
+  static bool Evaluate(const Comparison &comparison, AMXScript amx);
+
+ private:
+  std::vector<Comparison> comparisons_;
+  std::vector<Operand> captures_;
+  bool is_tracepoint_;
+  uint32_t hit_count_;
+  uint32_t every_;
+  uint32_t hits_;
+};
+
+#endif // !BREAKPOINTCONDITION_H
@@ -22,9 +22,12 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <functional>
 #include <iomanip>
 #include <sstream>
@@ -35,10 +38,13 @@
 
 #include "amxcallstack.h"
 #include "amxdebuginfo.h"
+#include "amxcallprofiler.h"
 #include "amxerror.h"
 #include "amxexecutor.h"
 #include "amxopcode.h"
+#include "amxopcodecounter.h"
 #include "amxpathfinder.h"
+#include "amxprofiler.h"
 #include "amxscript.h"
 #include "amxstacktrace.h"
 #include "debugplugin.h"
@@ -79,6 +85,8 @@ int CharToTraceFlag(char c) {
       return DebugPlugin::TRACE_PUBLICS;
     case 'f':
       return DebugPlugin::TRACE_FUNCTIONS;
+    case 'o':
+      return DebugPlugin::TRACE_OPCODES;
   }
   return 0;
 }
@@ -121,26 +129,122 @@ void PrintStream(FormattedPrinter printer, const std::stringstream &stream) {
   SplitString(stream.str(), '\n', PrintLine<FormattedPrinter>(printer));
 }
 
+// Elements of a variable sent in reply to QUERY_VARIABLE, at most. Bigger
+// arrays can be read with MEMORY_READ.
+const std::size_t kMaxVariableSize = 16384;
+
+// Appends the elements of an array row by row, skipping the indirection
+// vectors of multi-dimensional arrays. Returns false if it stopped short.
+bool ReadArray(AMXScript amx,
+               cell address,
+               const std::vector<AMXDebugSymbolDim> &dims,
+               std::size_t dim,
+               std::vector<cell> &values) {
+  cell size = dims[dim].GetSize();
+  if (dim + 1 == dims.size()) {
+    cell n = std::min<cell>(size, kMaxVariableSize - values.size());
+    if (!amx.IsValidDataRange(address, n)) {
+      return false;
+    }
+    const cell *elements =
+      reinterpret_cast<const cell*>(amx.GetData() + address);
+    values.insert(values.end(), elements, elements + n);
+    return n == size;
+  }
+  if (!amx.IsValidDataRange(address, size)) {
+    return false;
+  }
+  for (cell i = 0; i < size; i++) {
+    // Each entry is the offset of the row from the entry itself.
+    cell entry = address + i * sizeof(cell);
+    cell row = entry + *reinterpret_cast<const cell*>(amx.GetData() + entry);
+    if (!ReadArray(amx, row, dims, dim + 1, values)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Profiles go next to the script they're for.
+std::string GetProfilePath(const std::string &amx_path,
+                           const std::string &name) {
+  std::string::size_type separator = amx_path.find_last_of("/\\");
+  if (separator == std::string::npos) {
+    return name;
+  }
+  return amx_path.substr(0, separator + 1) + name;
+}
+
 } // anonymous namespace
 
 int DebugPlugin::trace_flags_(StringToTraceFlags(
   server_cfg.GetValueWithDefault("trace")));
+int DebugPlugin::trace_delay_(
+  server_cfg.GetValueWithDefault<int>("trace_delay"));
+bool DebugPlugin::fuse_instructions_(
+  server_cfg.GetValueWithDefault<bool>("fuse_instructions"));
 RegExp DebugPlugin::trace_filter_(
   server_cfg.GetValueWithDefault("trace_filter", ".*"));
+int DebugPlugin::profile_rate_(
+  server_cfg.GetValueWithDefault<int>("profile_rate"));
+bool DebugPlugin::profile_calls_(
+  server_cfg.GetValueWithDefault<bool>("profile_calls"));
+bool DebugPlugin::count_opcodes_(
+  server_cfg.GetValueWithDefault<bool>("count_opcodes"));
+bool DebugPlugin::native_stats_(
+  server_cfg.GetValueWithDefault<bool>("native_stats"));
+bool DebugPlugin::public_stats_enabled_(
+  server_cfg.GetValueWithDefault<bool>("public_stats"));
+int DebugPlugin::slow_callback_(
+  server_cfg.GetValueWithDefault<int>("slow_callback"));
 
 AMXCallStack DebugPlugin::call_stack_;
+Network DebugPlugin::network_;
+AMXSampler DebugPlugin::sampler_;
+AMXWatchdog DebugPlugin::watchdog_;
 
 DebugPlugin::DebugPlugin(AMX *amx)
  : AMXService<DebugPlugin>(amx),
+   executor_(AMXExecutor::GetInstance(amx)),
    prev_debug_(0),
    prev_callback_(0),
    last_frame_(amx->stp),
-   block_exec_errors_(false)
+   block_exec_errors_(false),
+   script_id_(0),
+   client_generation_(0),
+   state_(STATE_RUNNING),
+   step_(Task::STEP_OVER),
+   step_start_(0),
+   step_end_(0),
+   step_frm_(0),
+   conditions_(new ConditionTable),
+   has_retired_conditions_(false),
+   num_natives_(0),
+   callback_start_(0),
+   callback_depth_(0)
 {
 }
 
+DebugPlugin::~DebugPlugin() {
+  const ConditionTable *conditions = conditions_.load();
+  for (ConditionTable::const_iterator iterator = conditions->begin();
+       iterator != conditions->end(); iterator++) {
+    delete iterator->second;
+  }
+  delete conditions;
+}
+
 int DebugPlugin::Load() {
-  network_.Start();
+  if (trace_flags_ & TRACE_OPCODES) {
+    executor_->EnableFlags(AMXExecutor::EXEC_TRACE);
+  }
+  if (trace_delay_ > 0) {
+    executor_->set_throttle_delay(trace_delay_);
+    executor_->EnableFlags(AMXExecutor::EXEC_THROTTLE);
+  }
+  if (fuse_instructions_) {
+    executor_->FuseInstructions();
+  }
 
   AMXPathFinder amx_finder;
   amx_finder.AddSearchPath("gamemodes");
@@ -165,6 +269,38 @@ int DebugPlugin::Load() {
     amx_name_ = "<unknown>";
   }
 
+  if (public_stats_enabled_ || slow_callback_ > 0) {
+    // The last slot is for main().
+    PublicStats empty = {0, 0, 0, 0};
+    public_stats_.assign(amx().GetNumPublics() + 1, empty);
+  }
+  if (native_stats_) {
+    num_natives_ = amx().GetNumNatives();
+    native_latencies_.reset(new LatencyHistogram[num_natives_]);
+  }
+
+  script_id_ = network_.AddScript(amx_name_,
+    std::bind(&DebugPlugin::HandleDebuggerAttach, this, std::placeholders::_1),
+    std::bind(&DebugPlugin::HandleTask, this, std::placeholders::_1),
+    &traces_);
+
+  if (profile_rate_ > 0) {
+    executor_->set_profiler(&profiler_);
+    sampler_.Add(executor_, &profiler_);
+  }
+  if (slow_callback_ > 0) {
+    watchdog_.Add(executor_, &callback_start_);
+  }
+  if (profile_calls_) {
+    call_profiler_.reset(new AMXCallProfiler(amx(), executor_->program()));
+    executor_->set_call_profiler(call_profiler_.get());
+  }
+  if (count_opcodes_) {
+    opcode_counter_.reset(new AMXOpcodeCounter(executor_->program()));
+    executor_->set_opcode_counter(opcode_counter_.get());
+    executor_->EnableFlags(AMXExecutor::EXEC_COUNT);
+  }
+
   amx().DisableSysreqD();
   prev_debug_ = amx().GetDebugHook();
   prev_callback_ = amx().GetCallback();
@@ -173,28 +309,535 @@ int DebugPlugin::Load() {
 }
 
 int DebugPlugin::Unload() {
-  network_.Stop();
+  network_.RemoveScript(script_id_);
+
+  if (slow_callback_ > 0) {
+    watchdog_.Remove(executor_);
+  }
+  if (profile_rate_ > 0) {
+    sampler_.Remove(executor_);
+    executor_->set_profiler(0);
+    WriteProfile();
+  }
+  if (call_profiler_) {
+    executor_->set_call_profiler(0);
+    WriteCallProfile();
+  }
+  if (opcode_counter_) {
+    executor_->DisableFlags(AMXExecutor::EXEC_COUNT);
+    executor_->set_opcode_counter(0);
+    WriteOpcodeCounts();
+  }
 
   return AMX_ERR_NONE;
 }
 
+// static
+void DebugPlugin::StartDebugServer() {
+  network_.Start();
+}
+
+// static
+void DebugPlugin::StopDebugServer() {
+  network_.Stop();
+}
+
+// static
+void DebugPlugin::StartProfiler() {
+  sampler_.Start(profile_rate_);
+}
+
+// static
+void DebugPlugin::StopProfiler() {
+  sampler_.Stop();
+}
+
+// static
+void DebugPlugin::StartWatchdog() {
+  watchdog_.Start(slow_callback_);
+}
+
+// static
+void DebugPlugin::StopWatchdog() {
+  watchdog_.Stop();
+}
+
+void DebugPlugin::WriteProfile() {
+  profiler_.Collect();
+  if (amx_path_.empty() || profiler_.num_samples() == 0) {
+    return;
+  }
+
+  std::string path = GetProfilePath(amx_path_,
+    fileutils::GetBaseName(amx_path_) + ".folded");
+
+  std::ofstream stream(path.c_str());
+  if (!stream) {
+    LogDebugPrint("Could not write profile to %s", path.c_str());
+    return;
+  }
+  profiler_.WriteCollapsedStacks(stream, debug_info_);
+  LogDebugPrint("Wrote profile of %s to %s (%llu samples, %llu dropped)",
+                amx_name_.c_str(),
+                path.c_str(),
+                static_cast<unsigned long long>(profiler_.num_samples()),
+                static_cast<unsigned long long>(profiler_.num_dropped()));
+}
+
+void DebugPlugin::WriteCallProfile() {
+  if (amx_path_.empty()) {
+    return;
+  }
+
+  // KCachegrind picks up files named like this on its own.
+  std::string path = GetProfilePath(amx_path_,
+    "callgrind.out." + fileutils::GetBaseName(amx_path_));
+
+  std::ofstream stream(path.c_str());
+  if (!stream) {
+    LogDebugPrint("Could not write call profile to %s", path.c_str());
+    return;
+  }
+  call_profiler_->WriteCallgrind(stream, amx_name_, debug_info_);
+  LogDebugPrint("Wrote call profile of %s to %s",
+                amx_name_.c_str(),
+                path.c_str());
+}
+
+void DebugPlugin::WriteOpcodeCounts() {
+  if (amx_path_.empty() || opcode_counter_->total() == 0) {
+    return;
+  }
+
+  std::string path = GetProfilePath(amx_path_,
+    fileutils::GetBaseName(amx_path_) + ".opcounts");
+
+  std::ofstream stream(path.c_str());
+  if (!stream) {
+    LogDebugPrint("Could not write opcode counts to %s", path.c_str());
+    return;
+  }
+  opcode_counter_->WriteReport(stream, debug_info_);
+  LogDebugPrint("Wrote opcode counts of %s to %s",
+                amx_name_.c_str(),
+                path.c_str());
+}
+
+int DebugPlugin::HandleAMXExec(cell *retval, int index) {
+  // Resuming a sleeping script (AMX_EXEC_CONT) isn't a call of its own.
+  std::size_t slot = index == AMX_EXEC_MAIN ? public_stats_.size() - 1
+                                            : static_cast<std::size_t>(index);
+  if (public_stats_.empty() || slot >= public_stats_.size()) {
+    return executor_->HandleAMXExec(retval, index);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  if (slow_callback_ > 0 && callback_depth_++ == 0) {
+    // A backtrace asked for near the end of the previous callback would be
+    // of this one, and much too early.
+    executor_->DisableFlags(AMXExecutor::EXEC_BACKTRACE);
+    std::vector<cell> stale;
+    executor_->TakeBacktrace(stale);
+    callback_start_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      start.time_since_epoch()).count(), std::memory_order_relaxed);
+  }
+  int error = executor_->HandleAMXExec(retval, index);
+  uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  if (slow_callback_ > 0 && --callback_depth_ == 0) {
+    callback_start_.store(0, std::memory_order_relaxed);
+  }
+
+  PublicStats &stats = public_stats_[slot];
+  stats.calls++;
+  stats.total += time;
+  if (time > stats.max) {
+    stats.max = time;
+  }
+  if (slow_callback_ > 0 && time >= slow_callback_ * UINT64_C(1000000)) {
+    stats.slow++;
+    ReportSlowCallback(index, time);
+  }
+  return error;
+}
+
+void DebugPlugin::ReportSlowCallback(int index, uint64_t time) {
+  // The callback has returned by now. What there is to show is how it was
+  // called, the natives (possibly in other scripts) it was called from, and
+  // the Pawn stack the watchdog had recorded while the outermost callback
+  // was still running.
+  std::stringstream stream;
+  const char *name = index == AMX_EXEC_MAIN ? "main"
+                                            : amx().GetPublicName(index);
+  stream << "Slow callback: " << (name != 0 ? name : "<unknown>")
+         << " in " << amx_name_ << " took "
+         << std::fixed << std::setprecision(1) << time / 1000000.0 << " ms";
+
+  AMXCallStack calls = call_stack_;
+  while (!calls.IsEmpty()) {
+    AMXCall call = calls.Pop();
+    AMXScript caller = call.amx();
+    const char *caller_name = call.IsNative()
+      ? caller.GetNativeName(call.index())
+      : caller.GetPublicName(call.index());
+    stream << " <- " << (call.IsNative() ? "native " : "")
+           << (caller_name != 0 ? caller_name : "<unknown>");
+    DebugPlugin *plugin = DebugPlugin::FindInstance(caller);
+    if (plugin != 0 && caller != amx()) {
+      stream << " in " << plugin->amx_name_;
+    }
+  }
+
+  LogDebugPrint("%s", stream.str().c_str());
+
+  std::vector<cell> frames;
+  if (callback_depth_ != 0 || !executor_->TakeBacktrace(frames)) {
+    return;
+  }
+  for (std::size_t i = 0; i < frames.size(); i++) {
+    std::stringstream frame;
+    frame << "  #" << i << " 0x" << std::hex << std::setfill('0')
+          << std::setw(8) << frames[i] << std::dec;
+    if (debug_info_.IsLoaded()) {
+      std::string function = debug_info_.GetFunctionName(frames[i]);
+      std::string file = debug_info_.GetFileName(frames[i]);
+      int32_t line = debug_info_.GetLineNumber(frames[i]);
+      if (!function.empty()) {
+        frame << " in " << function;
+      }
+      if (!file.empty() && line >= 0) {
+        frame << " at " << file << ":" << line + 1;
+      }
+    }
+    LogDebugPrint("%s", frame.str().c_str());
+  }
+}
+
+const DebugPlugin::PublicStats *DebugPlugin::GetPublicStats(
+    cell index) const {
+  std::size_t slot = index == AMX_EXEC_MAIN ? public_stats_.size() - 1
+                                            : static_cast<std::size_t>(index);
+  if (public_stats_.empty() || slot >= public_stats_.size()) {
+    return 0;
+  }
+  return &public_stats_[slot];
+}
+
+void DebugPlugin::PrintPublicStats() const {
+  if (public_stats_.empty()) {
+    LogDebugPrint("Public stats are off (set public_stats to 1 to enable)");
+    return;
+  }
+
+  std::vector<std::size_t> slots;
+  for (std::size_t i = 0; i < public_stats_.size(); i++) {
+    if (public_stats_[i].calls > 0) {
+      slots.push_back(i);
+    }
+  }
+  std::sort(slots.begin(), slots.end(), [this](std::size_t a, std::size_t b) {
+    return public_stats_[a].total > public_stats_[b].total;
+  });
+
+  LogDebugPrint("Public stats of %s (microseconds):", amx_name_.c_str());
+  for (std::size_t i = 0; i < slots.size(); i++) {
+    const PublicStats &stats = public_stats_[slots[i]];
+    const char *name = slots[i] == public_stats_.size() - 1
+      ? "main"
+      : amx().GetPublicName(static_cast<int>(slots[i]));
+    LogDebugPrint("  %s: %llu calls, total %llu, avg %llu, max %llu, "
+                  "%llu slow",
+                  name != 0 ? name : "<unknown>",
+                  static_cast<unsigned long long>(stats.calls),
+                  static_cast<unsigned long long>(stats.total / 1000),
+                  static_cast<unsigned long long>(
+                    stats.total / stats.calls / 1000),
+                  static_cast<unsigned long long>(stats.max / 1000),
+                  static_cast<unsigned long long>(stats.slow));
+  }
+}
+
 int DebugPlugin::HandleAMXDebug() {
-  Task task = network_.GetTask();
+  // The executor only gets here at a breakpoint, after a write to watched
+  // memory or while stepping.
+  FreeRetiredConditions();
+
+  cell address, instruction;
+  if (executor_->TakeWatchpointHit(address, instruction)) {
+    Response::Watchpoint watchpoint;
+    watchpoint.set_address(address);
+    watchpoint.set_instruction_pointer(instruction);
+    Pause(&watchpoint);
+    return AMX_ERR_NONE;
+  }
 
-  switch (task.type()) {
-    case Task::RUN:
-      network_.SendSuccess();
+  switch (state_) {
+    case STATE_STEPPING_LINE:
+      if (network_.IsClientConnected()
+          && !IsLineStepDone()
+          && !(executor_->HasBreakpoint(amx().GetCip())
+               && CheckBreakpoint(amx().GetCip()))) {
+        break;
+      }
+      Pause(0);
       break;
-    case Task::QUERY_REGISTERS:
-      network_.SendRegisters(amx());
+    case STATE_RUNNING:
+      if (!CheckBreakpoint(amx().GetCip())) {
+        break;
+      }
+      // fall through
+    case STATE_STEPPING:
+      Pause(0);
       break;
-    case Task::UNKNOWN:
+  }
+  return AMX_ERR_NONE;
+}
+
+void DebugPlugin::Pause(const Response::Watchpoint *watchpoint) {
+  // Nobody to wait for: never stall the server because of a debugger that
+  // went away.
+  SetState(STATE_PAUSED);
+  if (!network_.IsClientConnected()) {
+    snapshot_.Clear();
+    SetState(STATE_RUNNING);
+    return;
+  }
+
+  // Clients that connected since the last stop haven't seen the snapshot
+  // that this one would be relative to.
+  int client_generation = network_.client_generation();
+  if (client_generation != client_generation_) {
+    snapshot_.Reset();
+    client_generation_ = client_generation;
+  }
+  network_.SendStopped(script_id_, amx(), snapshot_, watchpoint);
+
+  // This is the only place where the script thread blocks. The timeout lets
+  // it notice that the debugger has disconnected.
+  const int kPollInterval = 100;
+
+  for (;;) {
+    Task task;
+    if (!network_.WaitForTask(script_id_, task, kPollInterval)) {
+      if (!network_.IsClientConnected()) {
+        snapshot_.Clear();
+        SetState(STATE_RUNNING);
+        return;
+      }
+      continue;
+    }
+
+    switch (task.type()) {
+      case Task::RUN:
+        SetState(STATE_RUNNING);
+        network_.SendSuccess(script_id_);
+        return;
+      case Task::STEP_SINGLE:
+        SetState(STATE_STEPPING);
+        network_.SendSuccess(script_id_);
+        return;
+      case Task::STEP_LINE:
+        if (!StartLineStep(task.step())) {
+          network_.SendConfusion(script_id_);
+          break;
+        }
+        SetState(STATE_STEPPING_LINE);
+        network_.SendSuccess(script_id_);
+        return;
+      case Task::QUERY_REGISTERS:
+        network_.SendRegisters(script_id_, amx());
+        break;
+      case Task::MEMORY_READ:
+        ReadMemory(task.memory());
+        break;
+      case Task::MEMORY_WRITE:
+        WriteMemory(task.memory());
+        break;
+      case Task::MEMORY_READ_BATCH:
+        ReadMemoryBatch(task.memory());
+        break;
+      case Task::WATCH_ADD:
+        if (snapshot_.AddWatch(task.memory().address(),
+                               task.memory().count())) {
+          network_.SendSuccess(script_id_);
+        } else {
+          network_.SendConfusion(script_id_);
+        }
+        break;
+      case Task::WATCH_REMOVE:
+        if (snapshot_.RemoveWatch(task.memory().address(),
+                                  task.memory().count())) {
+          network_.SendSuccess(script_id_);
+        } else {
+          network_.SendConfusion(script_id_);
+        }
+        break;
+      case Task::QUERY_VARIABLE:
+        QueryVariable(task.variable());
+        break;
+      case Task::QUERY_SNAPSHOT:
+        snapshot_.Reset();
+        network_.SendStopped(script_id_, amx(), snapshot_, 0);
+        break;
+      case Task::UNKNOWN:
+      default:
+        network_.SendConfusion(script_id_);
+        break;
+    }
+  }
+}
+
+void DebugPlugin::ReadMemory(const Task::Memory &memory) {
+  if (!amx().IsValidDataRange(memory.address(), memory.count())) {
+    network_.SendConfusion(script_id_);
+    return;
+  }
+  const cell *values =
+    reinterpret_cast<const cell*>(amx().GetData() + memory.address());
+  network_.SendMemory(script_id_, memory.address(), sizeof(cell),
+                      values, memory.count());
+}
+
+void DebugPlugin::WriteMemory(const Task::Memory &memory) {
+  if (!amx().IsValidDataRange(memory.address(), memory.values_size())) {
+    network_.SendConfusion(script_id_);
+    return;
+  }
+  cell *values = reinterpret_cast<cell*>(amx().GetData() + memory.address());
+  std::copy(memory.values().begin(), memory.values().end(), values);
+  network_.SendSuccess(script_id_);
+}
+
+void DebugPlugin::ReadMemoryBatch(const Task::Memory &memory) {
+  // All or nothing, so that the reply lines up with the request.
+  std::vector<cell> values;
+  values.reserve(memory.addresses_size());
+  for (int i = 0; i < memory.addresses_size(); i++) {
+    cell address = memory.addresses(i);
+    if (!amx().IsValidDataRange(address, 1)) {
+      network_.SendConfusion(script_id_);
+      return;
+    }
+    values.push_back(*reinterpret_cast<const cell*>(amx().GetData() + address));
+  }
+  network_.SendMemory(script_id_, 0, 1, values.data(), values.size());
+}
+
+void DebugPlugin::QueryVariable(const std::string &name) {
+  AMXDebugSymbol symbol;
+  if (debug_info_.IsLoaded()) {
+    symbol = debug_info_.GetVariable(name, amx().GetCip());
+  }
+  if (!symbol) {
+    network_.SendConfusion(script_id_);
+    return;
+  }
+
+  cell address = symbol.GetAddress();
+  if (symbol.IsLocal()) {
+    address += amx().GetFrm();
+  }
+  if (symbol.IsReference() || symbol.IsArrayRef()) {
+    if (!amx().IsValidDataRange(address, 1)) {
+      network_.SendConfusion(script_id_);
+      return;
+    }
+    address = *reinterpret_cast<cell*>(amx().GetData() + address);
+  }
+
+  std::string tag = debug_info_.GetTagName(symbol.GetTag());
+
+  Response::Variable variable;
+  variable.set_name(name);
+  variable.set_scope(static_cast<Response::Variable::Scope>(symbol.GetVClass()));
+  variable.set_tag(tag);
+  if (tag == "Float") {
+    variable.set_type(Response::Variable::FLOAT);
+  } else if (tag == "bool") {
+    variable.set_type(Response::Variable::BOOL);
+  }
+  variable.set_address(address);
+
+  std::vector<cell> values;
+  bool complete = true;
+  if (symbol.IsArray() || symbol.IsArrayRef()) {
+    std::vector<AMXDebugSymbolDim> dims = symbol.GetDims();
+    for (std::size_t i = 0; i < dims.size(); i++) {
+      Response::Variable::Dimension *dimension = variable.add_dimensions();
+      dimension->set_size(dims[i].GetSize());
+      dimension->set_tag(debug_info_.GetTagName(dims[i].GetTag()));
+    }
+    if (!dims.empty()) {
+      complete = ReadArray(amx(), address, dims, 0, values);
+    }
+  } else {
+    complete = amx().IsValidDataRange(address, 1);
+    if (complete) {
+      values.push_back(*reinterpret_cast<cell*>(amx().GetData() + address));
+    }
+  }
+  variable.mutable_values()->Reserve(static_cast<int>(values.size()));
+  for (std::size_t i = 0; i < values.size(); i++) {
+    variable.add_values(values[i]);
+  }
+  variable.set_truncated(!complete);
+
+  network_.SendVariable(script_id_, variable);
+}
+
+bool DebugPlugin::StartLineStep(Task::Step step) {
+  // Remember the code range of the current line and the current frame, so
+  // that checking whether the step is over is cheap enough to do before
+  // every instruction.
+  if (!debug_info_.IsLoaded()) {
+    return false;
+  }
+  if (!debug_info_.GetLineRange(amx().GetCip(), step_start_, step_end_)) {
+    step_start_ = step_end_ = amx().GetCip();
+  }
+  step_ = step;
+  step_frm_ = amx().GetFrm();
+  return true;
+}
+
+bool DebugPlugin::IsLineStepDone() const {
+  cell cip = amx().GetCip();
+  cell frm = amx().GetFrm();
+
+  // The stack grows down: a higher frame address means the function we
+  // started in has returned.
+  if (frm > step_frm_) {
+    return true;
+  }
+  if (frm == step_frm_ && cip >= step_start_ && cip < step_end_) {
+    return false;
+  }
+  switch (step_) {
+    case Task::STEP_INTO:
+      return debug_info_.IsLineStart(cip);
+    case Task::STEP_OVER:
+      return frm == step_frm_ && debug_info_.IsLineStart(cip);
+    case Task::STEP_OUT:
     default:
-      network_.SendConfusion();
-      break;
+      return false;
   }
+}
 
-  return AMX_ERR_NONE;
+void DebugPlugin::SetState(ExecState state) {
+  // While running the executor checks nothing but its (atomic) flags, and
+  // only asks for the debug hook on every instruction while stepping.
+  //
+  // Only the script thread calls this. The network thread may turn RUNNING
+  // into STEPPING at any time (see Task::STOP), so the flag is cleared before
+  // RUNNING is published: that way a STOP that comes in between always gets
+  // the last word.
+  if (state == STATE_STEPPING || state == STATE_STEPPING_LINE) {
+    state_ = state;
+    executor_->EnableFlags(AMXExecutor::EXEC_DEBUG);
+  } else {
+    executor_->DisableFlags(AMXExecutor::EXEC_DEBUG);
+    state_ = state;
+  }
 }
 
 int DebugPlugin::HandleAMXCallback(cell index, cell *result, cell *params) {
@@ -209,12 +852,88 @@ int DebugPlugin::HandleAMXCallback(cell index, cell *result, cell *params) {
     }
   }
 
-  int error = prev_callback_(amx(), index, result, params);
+  int error;
+  if (native_latencies_ && index >= 0 && index < num_natives_) {
+    auto start = std::chrono::steady_clock::now();
+    error = prev_callback_(amx(), index, result, params);
+    auto duration = std::chrono::steady_clock::now() - start;
+    native_latencies_[index].Add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+  } else {
+    error = prev_callback_(amx(), index, result, params);
+  }
 
   call_stack_.Pop();
   return error;
 }
 
+const LatencyHistogram *DebugPlugin::GetNativeLatency(cell index) const {
+  if (!native_latencies_ || index < 0 || index >= num_natives_) {
+    return 0;
+  }
+  return &native_latencies_[index];
+}
+
+void DebugPlugin::PrintNativeStats() const {
+  if (!native_latencies_) {
+    LogDebugPrint("Native stats are off (set native_stats to 1 to enable)");
+    return;
+  }
+
+  std::vector<int> natives;
+  for (int i = 0; i < num_natives_; i++) {
+    if (native_latencies_[i].count() > 0) {
+      natives.push_back(i);
+    }
+  }
+  std::sort(natives.begin(), natives.end(), [this](int a, int b) {
+    return native_latencies_[a].total() > native_latencies_[b].total();
+  });
+
+  LogDebugPrint("Native stats of %s (microseconds):", amx_name_.c_str());
+  for (std::size_t i = 0; i < natives.size(); i++) {
+    const LatencyHistogram &latency = native_latencies_[natives[i]];
+    const char *name = amx().GetNativeName(natives[i]);
+    LogDebugPrint("  %s: %llu calls, total %llu, p50 %llu, p99 %llu, max %llu",
+                  name != 0 ? name : "<unknown>",
+                  static_cast<unsigned long long>(latency.count()),
+                  static_cast<unsigned long long>(latency.total() / 1000),
+                  static_cast<unsigned long long>(
+                    latency.GetPercentile(50) / 1000),
+                  static_cast<unsigned long long>(
+                    latency.GetPercentile(99) / 1000),
+                  static_cast<unsigned long long>(latency.max() / 1000));
+  }
+}
+
+void DebugPlugin::SendNativeStats() {
+  // Called from the network thread while the script may be running; the
+  // histograms are safe to read concurrently and the native table never
+  // changes after load.
+  if (!native_latencies_) {
+    network_.SendConfusion(script_id_);
+    return;
+  }
+
+  google::protobuf::RepeatedPtrField<Response::NativeStats> stats;
+  for (int i = 0; i < num_natives_; i++) {
+    const LatencyHistogram &latency = native_latencies_[i];
+    if (latency.count() == 0) {
+      continue;
+    }
+    const char *name = amx().GetNativeName(i);
+    Response::NativeStats *native = stats.Add();
+    native->set_index(i);
+    native->set_name(name != 0 ? name : "");
+    native->set_calls(latency.count());
+    native->set_total(latency.total());
+    native->set_p50(latency.GetPercentile(50));
+    native->set_p99(latency.GetPercentile(99));
+    native->set_max(latency.max());
+  }
+  network_.SendNativeStats(script_id_, stats);
+}
+
 void DebugPlugin::HandleAMXExecError(int index,
                                      cell *retval,
                                      const AMXError &error) {
@@ -280,6 +999,199 @@ void DebugPlugin::HandleAMXExecError(int index,
   block_exec_errors_ = false;
 }
 
+void DebugPlugin::HandleDebuggerAttach(bool attached) {
+  // Called from the network thread. Nothing runs slower on attach: the
+  // debug hook is only called once a breakpoint is set or the debugger
+  // asks to stop. On detach, drop the breakpoints and let the script go.
+  // The state is left to the script thread: if it's paused or stepping,
+  // Pause() notices that nobody is connected and resumes on its own.
+  if (!attached) {
+    executor_->RemoveAllBreakpoints();
+    executor_->RemoveAllWatchpoints();
+    {
+      std::lock_guard<std::mutex> lock(conditions_mutex_);
+      ClearConditions();
+    }
+  }
+}
+
+bool DebugPlugin::HandleTask(const Task &task) {
+  // Called from the network thread. Breakpoints can be changed and the
+  // script stopped while it's running; everything else is queued for
+  // Pause() and makes no sense unless the script is paused.
+  switch (task.type()) {
+    case Task::BREAKPOINT_ADD:
+      if (AddBreakpoint(task.breakpoint())) {
+        network_.SendSuccess(script_id_);
+      } else {
+        network_.SendConfusion(script_id_);
+      }
+      return true;
+    case Task::BREAKPOINT_REMOVE:
+      if (RemoveBreakpoint(task.breakpoint().instruction_pointer())) {
+        network_.SendSuccess(script_id_);
+      } else {
+        network_.SendConfusion(script_id_);
+      }
+      return true;
+    case Task::WATCHPOINT_ADD:
+    case Task::WATCHPOINT_REMOVE: {
+      // Nothing past the top of the stack can be written to. Compare in 64
+      // bits so that a huge count can't wrap around.
+      cell address = task.memory().address();
+      int32_t count = task.memory().count();
+      int64_t end = static_cast<int64_t>(address)
+        + static_cast<int64_t>(count) * sizeof(cell);
+      if (address < 0 || count <= 0 || end > amx().GetStp()) {
+        network_.SendConfusion(script_id_);
+        return true;
+      }
+      cell size = count * sizeof(cell);
+      bool ok = task.type() == Task::WATCHPOINT_ADD
+        ? executor_->AddWatchpoint(address, size)
+        : executor_->RemoveWatchpoint(address, size);
+      if (ok) {
+        network_.SendSuccess(script_id_);
+      } else {
+        network_.SendConfusion(script_id_);
+      }
+      return true;
+    }
+    case Task::QUERY_NATIVE_STATS:
+      SendNativeStats();
+      return true;
+    case Task::STOP: {
+      int running = STATE_RUNNING;
+      if (state_.compare_exchange_strong(running, STATE_STEPPING)) {
+        executor_->EnableFlags(AMXExecutor::EXEC_DEBUG);
+      }
+      network_.SendSuccess(script_id_);
+      return true;
+    }
+    default:
+      if (state_ != STATE_PAUSED) {
+        network_.SendConfusion(script_id_);
+        return true;
+      }
+      return false;
+  }
+}
+
+bool DebugPlugin::AddBreakpoint(const Task::Breakpoint &breakpoint) {
+  cell address = breakpoint.instruction_pointer();
+
+  // Adding a breakpoint where there already is one replaces its condition
+  // and starts counting hits over.
+  std::unique_ptr<BreakpointCondition> condition;
+  if (breakpoint.conditions_size() > 0
+      || breakpoint.hit_count() > 1
+      || breakpoint.every() > 1
+      || breakpoint.trace()) {
+    condition.reset(new BreakpointCondition);
+    if (!condition->Compile(breakpoint, debug_info_)) {
+      return false;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(conditions_mutex_);
+    SetCondition(address, condition.release());
+  }
+  if (!executor_->SetBreakpoint(address)) {
+    std::lock_guard<std::mutex> lock(conditions_mutex_);
+    SetCondition(address, 0);
+    return false;
+  }
+  return true;
+}
+
+bool DebugPlugin::RemoveBreakpoint(cell address) {
+  {
+    std::lock_guard<std::mutex> lock(conditions_mutex_);
+    SetCondition(address, 0);
+  }
+  return executor_->RemoveBreakpoint(address);
+}
+
+void DebugPlugin::SetCondition(cell address,
+                               BreakpointCondition *condition) {
+  const ConditionTable *old_conditions =
+    conditions_.load(std::memory_order_relaxed);
+  ConditionTable::const_iterator iterator = old_conditions->find(address);
+  if (iterator == old_conditions->end() && condition == 0) {
+    return;
+  }
+
+  ConditionTable *conditions = new ConditionTable(*old_conditions);
+  if (iterator != old_conditions->end()) {
+    retired_conditions_.emplace_back(iterator->second);
+    conditions->erase(address);
+  }
+  if (condition != 0) {
+    (*conditions)[address] = condition;
+  }
+  conditions_.store(conditions, std::memory_order_release);
+  retired_tables_.emplace_back(old_conditions);
+  has_retired_conditions_.store(true, std::memory_order_relaxed);
+}
+
+void DebugPlugin::ClearConditions() {
+  const ConditionTable *old_conditions =
+    conditions_.load(std::memory_order_relaxed);
+  if (old_conditions->empty()) {
+    return;
+  }
+  for (ConditionTable::const_iterator iterator = old_conditions->begin();
+       iterator != old_conditions->end(); iterator++) {
+    retired_conditions_.emplace_back(iterator->second);
+  }
+  conditions_.store(new ConditionTable, std::memory_order_release);
+  retired_tables_.emplace_back(old_conditions);
+  has_retired_conditions_.store(true, std::memory_order_relaxed);
+}
+
+void DebugPlugin::FreeRetiredConditions() {
+  // Called on the script thread between lookups. Never wait for the
+  // network thread here; if it's busy changing the table, try next time.
+  if (!has_retired_conditions_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(conditions_mutex_, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return;
+  }
+  retired_tables_.clear();
+  retired_conditions_.clear();
+  has_retired_conditions_.store(false, std::memory_order_relaxed);
+}
+
+bool DebugPlugin::CheckBreakpoint(cell address) {
+  // Called on the script thread at every hit. Unconditional breakpoints
+  // have no entry.
+  const ConditionTable *conditions =
+    conditions_.load(std::memory_order_acquire);
+  ConditionTable::const_iterator iterator = conditions->find(address);
+  if (iterator == conditions->end()) {
+    return true;
+  }
+  BreakpointCondition &condition = *iterator->second;
+  if (!condition.Check(amx())) {
+    return false;
+  }
+  if (!condition.is_tracepoint()) {
+    return true;
+  }
+
+  // Record and move on; the network thread sends it when it gets around to
+  // it. If it's fallen behind the record is dropped (and counted).
+  TraceRecord record;
+  record.address = address;
+  record.time = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+  condition.Capture(amx(), record);
+  traces_.Push(record);
+  return false;
+}
+
 void DebugPlugin::HandleException() {
   LogDebugPrint("Server crashed while executing %s", amx_name_.c_str());
   PrintAMXBacktrace();
@@ -333,12 +1245,13 @@ void DebugPlugin::PrintTraceFrame(const AMXStackFrame &frame,
 // static
 void DebugPlugin::PrintRuntimeError(AMXScript amx, const AMXError &error) {
   LogDebugPrint("Run time error %d: \"%s\"", error.code(), error.GetString());
-  cell *ip = reinterpret_cast<cell*>(amx.GetCode() + amx.GetCip());
+  const AMXProgram &program = AMXExecutor::GetInstance(amx)->program();
   switch (error.code()) {
     case AMX_ERR_BOUNDS: {
-      cell opcode = *ip;
-      if (opcode == RelocateAMXOpcode(AMX_OP_BOUNDS)) {
-        cell upper_bound = *(ip + 1);
+      // CIP points past the failed "bounds" instruction.
+      const AMXInstruction *instr = program.FindPrevious(amx.GetCip());
+      if (instr != 0 && program.GetOpcode(instr) == AMX_OP_BOUNDS) {
+        cell upper_bound = instr->operand;
         cell index = amx.GetPri();
         if (index < 0) {
           LogDebugPrint(" Attempted to read/write array element at negative "
@@ -373,16 +1286,15 @@ void DebugPlugin::PrintRuntimeError(AMXScript amx, const AMXError &error) {
                     amx.GetHea(), amx.GetHlw());
       break;
     case AMX_ERR_INVINSTR: {
-      cell opcode = *ip;
+      cell opcode = *reinterpret_cast<cell*>(amx.GetCode() + amx.GetCip());
       LogDebugPrint(" Unknown opcode 0x%x at address 0x%08X",
-                    opcode , amx.GetCip());
+                    opcode, amx.GetCip());
       break;
     }
     case AMX_ERR_NATIVE: {
-      cell opcode = *(ip - 2);
-      if (opcode == RelocateAMXOpcode(AMX_OP_SYSREQ_C)) {
-        cell index = *(ip - 1);
-        LogDebugPrint(" %s", amx.GetNativeName(index));
+      const AMXInstruction *instr = program.FindPrevious(amx.GetCip());
+      if (instr != 0 && program.GetOpcode(instr) == AMX_OP_SYSREQ_C) {
+        LogDebugPrint(" %s", amx.GetNativeName(instr->operand));
       }
       break;
     }
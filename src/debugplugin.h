@@ -25,18 +25,34 @@
 #ifndef DEBUG_PLUGIN_H
 #define DEBUG_PLUGIN_H
 
+#include <atomic>
 #include <cstdarg>
+#include <cstdint>
 #include <cstdio>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "amxcallprofiler.h"
 #include "amxcallstack.h"
 #include "amxdebuginfo.h"
+#include "amxopcodecounter.h"
+#include "amxprofiler.h"
+#include "amxsampler.h"
 #include "amxscript.h"
+#include "amxsnapshot.h"
 #include "amxservice.h"
+#include "amxwatchdog.h"
+#include "breakpointcondition.h"
+#include "latencyhistogram.h"
 #include "network.h"
 #include "regexp.h"
+#include "tracebuffer.h"
 
 class AMXError;
+class AMXExecutor;
 class AMXStackFrame;
 
 namespace os {
@@ -47,20 +63,44 @@ class DebugPlugin : public AMXService<DebugPlugin> {
  friend class AMXService<DebugPlugin>;
 
  public:
+  // What the script does when the debugger isn't looking at it.
+  enum ExecState {
+    STATE_RUNNING,       // run until a breakpoint
+    STATE_STEPPING,      // stop at the next instruction (STOP, STEP_SINGLE)
+    STATE_STEPPING_LINE, // stop once StartLineStep()'s condition is met
+    STATE_PAUSED         // stopped, waiting for tasks in HandleAMXDebug()
+  };
+
   enum TraceFlags {
     TRACE_NONE = 0x00,
     TRACE_NATIVES = 0x01,
     TRACE_PUBLICS = 0x02,
-    TRACE_FUNCTIONS = 0x04
+    TRACE_FUNCTIONS = 0x04,
+    TRACE_OPCODES = 0x08
   };
 
   int Load();
   int Unload();
 
+  int HandleAMXExec(cell *retval, int index);
   int HandleAMXDebug();
   int HandleAMXCallback(cell index, cell *result, cell *params);
   void HandleAMXExecError(int index, cell *retval, const AMXError &error);
 
+  // There's one debug server for all scripts.
+  static void StartDebugServer();
+  static void StopDebugServer();
+
+  // Sampling profiler, if profile_rate is set. Each script's profile is
+  // written out when it's unloaded.
+  static void StartProfiler();
+  static void StopProfiler();
+
+  // Asks for a backtrace of callbacks that run for longer than
+  // slow_callback, if it's set, while they're still running.
+  static void StartWatchdog();
+  static void StopWatchdog();
+
   static void OnCrash(const os::Context &context);
   static void OnInterrupt(const os::Context &context);
 
@@ -71,7 +111,51 @@ class DebugPlugin : public AMXService<DebugPlugin> {
   static void PrintNativeBacktrace(std::ostream &stream,
                                    const os::Context &context);
 
+  // How long calls to a native took, if native_stats is on. Returns null
+  // if it's off or the index is out of range.
+  const LatencyHistogram *GetNativeLatency(cell index) const;
+
+  // Logs the latency of every native that was called, slowest in total
+  // first.
+  void PrintNativeStats() const;
+
+  // Number of calls, total and longest wall time (in nanoseconds) and how
+  // many calls went over slow_callback, per public function. Kept if
+  // public_stats or slow_callback is set.
+  struct PublicStats {
+    uint64_t calls;
+    uint64_t total;
+    uint64_t max;
+    uint64_t slow;
+  };
+
+  // Returns null if stats are off or there's no such public. index can be
+  // AMX_EXEC_MAIN.
+  const PublicStats *GetPublicStats(cell index) const;
+
+  // Logs the stats of every public that was called, slowest in total first.
+  void PrintPublicStats() const;
+
  private:
+  void HandleDebuggerAttach(bool attached);
+  bool HandleTask(const Task &task);
+  bool AddBreakpoint(const Task::Breakpoint &breakpoint);
+  bool RemoveBreakpoint(cell address);
+  bool CheckBreakpoint(cell address);
+  bool StartLineStep(Task::Step step);
+  bool IsLineStepDone() const;
+  void Pause(const Response::Watchpoint *watchpoint);
+  void ReadMemory(const Task::Memory &memory);
+  void WriteMemory(const Task::Memory &memory);
+  void ReadMemoryBatch(const Task::Memory &memory);
+  void QueryVariable(const std::string &name);
+  void SendNativeStats();
+  void ReportSlowCallback(int index, uint64_t time);
+  void SetState(ExecState state);
+  void WriteProfile();
+  void WriteCallProfile();
+  void WriteOpcodeCounts();
+
   void HandleException();
   void HandleInterrupt();
 
@@ -88,21 +172,71 @@ class DebugPlugin : public AMXService<DebugPlugin> {
 
  private:
   DebugPlugin(AMX *amx);
+  ~DebugPlugin();
+
+  typedef std::unordered_map<cell, BreakpointCondition*> ConditionTable;
+
+  // Replaces (or with null, removes) the condition at address. Must be
+  // called with conditions_mutex_ held.
+  void SetCondition(cell address, BreakpointCondition *condition);
+  void ClearConditions();
+  void FreeRetiredConditions();
 
  private:
   AMXDebugInfo debug_info_;
-  Network network_;
+  AMXExecutor *executor_;
   AMX_DEBUG prev_debug_;
   AMX_CALLBACK prev_callback_;
   cell last_frame_;
   std::string amx_path_;
   std::string amx_name_;
   bool block_exec_errors_;
+  int script_id_;
+  AMXSnapshot snapshot_;
+  int client_generation_;
+  std::atomic<int> state_;
+  Task::Step step_;
+  cell step_start_;
+  cell step_end_;
+  cell step_frm_;
+  // Conditions of conditional breakpoints and tracepoints, by address. The
+  // script thread looks them up without locking: the network thread changes
+  // a copy of the table and then publishes it. Replaced tables and
+  // conditions are freed by the script thread on its next debug hook call,
+  // when it's not looking at any of them. Hit counts live in the conditions
+  // and are only touched by the script thread.
+  std::mutex conditions_mutex_; // serializes changes
+  std::atomic<const ConditionTable*> conditions_;
+  std::vector<std::unique_ptr<const ConditionTable>> retired_tables_;
+  std::vector<std::unique_ptr<BreakpointCondition>> retired_conditions_;
+  std::atomic<bool> has_retired_conditions_;
+  TraceBuffer traces_;
+  AMXProfiler profiler_;
+  std::unique_ptr<AMXCallProfiler> call_profiler_;
+  std::unique_ptr<AMXOpcodeCounter> opcode_counter_;
+  std::unique_ptr<LatencyHistogram[]> native_latencies_;
+  int num_natives_;
+  std::vector<PublicStats> public_stats_;
+  // When the outermost callback started, for the watchdog (0 if the script
+  // isn't running), and how deep the script is in callbacks right now.
+  std::atomic<int64_t> callback_start_;
+  int callback_depth_;
 
  private:
   static int trace_flags_;
+  static int trace_delay_;
+  static bool fuse_instructions_;
   static RegExp trace_filter_;
+  static int profile_rate_;
+  static bool profile_calls_;
+  static bool count_opcodes_;
+  static bool native_stats_;
+  static bool public_stats_enabled_;
+  static int slow_callback_;
   static AMXCallStack call_stack_;
+  static Network network_;
+  static AMXSampler sampler_;
+  static AMXWatchdog watchdog_;
 };
 
 #endif // !DEBUG_PLUGIN_H
@@ -0,0 +1,52 @@
+#ifndef INTERVALSET_H
+#define INTERVALSET_H
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <amx/amx.h>
+
+// A set of addresses made of half-open ranges [start, end). Overlapping and
+// adjacent ranges are merged and the result is kept as one sorted array of
+// boundaries, so checking a range against the set is a single binary search.
+class IntervalSet {
+ public:
+  typedef std::pair<cell, cell> Range;
+
+  IntervalSet() {}
+
+  explicit IntervalSet(std::vector<Range> ranges) {
+    std::sort(ranges.begin(), ranges.end());
+    for (std::size_t i = 0; i < ranges.size(); i++) {
+      if (ranges[i].first >= ranges[i].second) {
+        continue;
+      }
+      if (!bounds_.empty() && ranges[i].first <= bounds_.back()) {
+        bounds_.back() = std::max(bounds_.back(), ranges[i].second);
+      } else {
+        bounds_.push_back(ranges[i].first);
+        bounds_.push_back(ranges[i].second);
+      }
+    }
+  }
+
+  bool IsEmpty() const { return bounds_.empty(); }
+
+  bool Overlaps(cell start, cell end) const {
+    if (bounds_.empty() || end <= bounds_.front() || start >= bounds_.back()) {
+      return false;
+    }
+    // An odd index means start is inside a range, an even one that it's in
+    // the gap before bounds_[i].
+    std::size_t i = std::upper_bound(bounds_.begin(), bounds_.end(), start)
+                  - bounds_.begin();
+    return i % 2 == 1 || (i < bounds_.size() && bounds_[i] < end);
+  }
+
+ private:
+  std::vector<cell> bounds_;
+};
+
+#endif // !INTERVALSET_H
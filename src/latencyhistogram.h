@@ -0,0 +1,112 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+// Counts durations (in nanoseconds) in logarithmic buckets: four per power
+// of two, so a percentile read from it is off by at most a quarter. Only
+// one thread may Add(); any thread may read.
+class LatencyHistogram {
+ public:
+  static const int kSubBuckets = 4;
+  static const int kMaxExponent = 36; // about 69 seconds, longer is clamped
+  static const int kNumBuckets = kMaxExponent * kSubBuckets;
+
+  LatencyHistogram()
+   : count_(0),
+     total_(0),
+     max_(0)
+  {
+    for (int i = 0; i < kNumBuckets; i++) {
+      buckets_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void Add(uint64_t value) {
+    Increment(buckets_[GetBucket(value)], 1);
+    Increment(count_, 1);
+    Increment(total_, value);
+    if (value > max_.load(std::memory_order_relaxed)) {
+      max_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t total() const { return total_.load(std::memory_order_relaxed); }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+  // Returns the upper bound of the bucket that holds the given percentile
+  // (0-100), or 0 if nothing was counted.
+  uint64_t GetPercentile(double percentile) const {
+    uint64_t count = this->count();
+    if (count == 0) {
+      return 0;
+    }
+    // Nearest rank, counting from 0.
+    uint64_t rank =
+      static_cast<uint64_t>(std::ceil(count * percentile / 100.0));
+    rank = rank > 0 ? std::min(rank, count) - 1 : 0;
+    uint64_t seen = 0;
+    for (int i = 0; i < kNumBuckets - 1; i++) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen > rank) {
+        return std::min(GetUpperBound(i), max());
+      }
+    }
+    return max();
+  }
+
+ private:
+  // Writes are never concurrent, so there's no need for a locked add.
+  template<typename T>
+  static void Increment(std::atomic<T> &counter,
+                        typename std::atomic<T>::value_type value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+  static int Log2(uint64_t value) {
+    int n = 0;
+    for (int shift = 32; shift > 0; shift /= 2) {
+      if (value >= (uint64_t(1) << shift)) {
+        value >>= shift;
+        n += shift;
+      }
+    }
+    return n;
+  }
+
+  static int GetBucket(uint64_t value) {
+    if (value < kSubBuckets) {
+      return static_cast<int>(value);
+    }
+    int exponent = Log2(value);
+    if (exponent >= kMaxExponent) {
+      return kNumBuckets - 1;
+    }
+    // The two bits after the leading one pick the sub-bucket.
+    return (exponent - 1) * kSubBuckets
+         + static_cast<int>((value >> (exponent - 2)) & (kSubBuckets - 1));
+  }
+
+  static uint64_t GetUpperBound(int bucket) {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    int exponent = bucket / kSubBuckets + 1;
+    uint64_t lower =
+      uint64_t(kSubBuckets + bucket % kSubBuckets) << (exponent - 2);
+    return lower + (uint64_t(1) << (exponent - 2)) - 1;
+  }
+
+ private:
+  std::atomic<uint32_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> total_;
+  std::atomic<uint64_t> max_;
+};
+
+#endif // !LATENCYHISTOGRAM_H
@@ -22,14 +22,41 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <cstring>
 #include <sstream>
+#include <vector>
 
+#include "amxexecutor.h"
 #include "debugplugin.h"
 #include "natives.h"
 #include "os.h"
 
 namespace {
 
+bool GetStringParam(AMX *amx, cell param, std::vector<char> &string) {
+  cell *string_ptr;
+  int length;
+  if (amx_GetAddr(amx, param, &string_ptr) != AMX_ERR_NONE
+      || amx_StrLen(string_ptr, &length) != AMX_ERR_NONE) {
+    return false;
+  }
+  string.resize(length + 1);
+  return amx_GetString(string.data(), string_ptr, 0, string.size())
+         == AMX_ERR_NONE;
+}
+
+bool SetRefParams(AMX *amx, const cell *params, const cell *values,
+                  int count) {
+  for (int i = 0; i < count; i++) {
+    cell *value_ptr;
+    if (amx_GetAddr(amx, params[i], &value_ptr) != AMX_ERR_NONE) {
+      return false;
+    }
+    *value_ptr = values[i];
+  }
+  return true;
+}
+
 // native PrintAmxBacktrace();
 cell AMX_NATIVE_CALL PrintBacktrace(AMX *amx, cell *params) {
   DebugPlugin::PrintAMXBacktrace();
@@ -74,11 +101,106 @@ cell AMX_NATIVE_CALL GetNativeBacktrace(AMX *amx, cell *params) {
   return 0;
 }
 
+// native SetOpcodeTrace(bool:enable, throttle = 0);
+cell AMX_NATIVE_CALL SetOpcodeTrace(AMX *amx, cell *params) {
+  bool enable = params[1] != 0;
+  cell throttle = params[2];
+
+  AMXExecutor *executor = AMXExecutor::GetInstance(amx);
+  if (!enable) {
+    executor->DisableFlags(AMXExecutor::EXEC_TRACE |
+                           AMXExecutor::EXEC_THROTTLE);
+    return 1;
+  }
+
+  executor->EnableFlags(AMXExecutor::EXEC_TRACE);
+  if (throttle > 0) {
+    executor->set_throttle_delay(throttle);
+    executor->EnableFlags(AMXExecutor::EXEC_THROTTLE);
+  } else {
+    executor->DisableFlags(AMXExecutor::EXEC_THROTTLE);
+  }
+  return 1;
+}
+
+// native GetNativeStats(const name[], &calls, &p50, &p99, &max);
+cell AMX_NATIVE_CALL GetNativeStats(AMX *amx, cell *params) {
+  std::vector<char> name;
+  if (!GetStringParam(amx, params[1], name)) {
+    return 0;
+  }
+
+  DebugPlugin *plugin = DebugPlugin::GetInstance(amx);
+  const LatencyHistogram *latency =
+    plugin->GetNativeLatency(AMXScript(amx).GetNativeIndex(name.data()));
+  if (latency == 0) {
+    return 0;
+  }
+
+  // Percentiles and max are in microseconds.
+  cell values[] = {
+    static_cast<cell>(latency->count()),
+    static_cast<cell>(latency->GetPercentile(50) / 1000),
+    static_cast<cell>(latency->GetPercentile(99) / 1000),
+    static_cast<cell>(latency->max() / 1000)
+  };
+  return SetRefParams(amx, &params[2], values, 4);
+}
+
+// native PrintNativeStats();
+cell AMX_NATIVE_CALL PrintNativeStats(AMX *amx, cell *params) {
+  DebugPlugin::GetInstance(amx)->PrintNativeStats();
+  return 1;
+}
+
+// native GetPublicStats(const name[], &calls, &average, &max, &slow);
+cell AMX_NATIVE_CALL GetPublicStats(AMX *amx, cell *params) {
+  std::vector<char> name;
+  if (!GetStringParam(amx, params[1], name)) {
+    return 0;
+  }
+
+  cell index = AMXScript(amx).GetPublicIndex(name.data());
+  if (index < 0) {
+    if (std::strcmp(name.data(), "main") != 0) {
+      return 0;
+    }
+    index = AMX_EXEC_MAIN;
+  }
+
+  DebugPlugin *plugin = DebugPlugin::GetInstance(amx);
+  const DebugPlugin::PublicStats *stats = plugin->GetPublicStats(index);
+  if (stats == 0) {
+    return 0;
+  }
+
+  // Times are in microseconds.
+  cell values[] = {
+    static_cast<cell>(stats->calls),
+    static_cast<cell>(stats->calls > 0
+                      ? stats->total / stats->calls / 1000 : 0),
+    static_cast<cell>(stats->max / 1000),
+    static_cast<cell>(stats->slow)
+  };
+  return SetRefParams(amx, &params[2], values, 4);
+}
+
+// native PrintPublicStats();
+cell AMX_NATIVE_CALL PrintPublicStats(AMX *amx, cell *params) {
+  DebugPlugin::GetInstance(amx)->PrintPublicStats();
+  return 1;
+}
+
 const AMX_NATIVE_INFO natives[] = {
   {"PrintBacktrace",       PrintBacktrace},
   {"PrintNativeBacktrace", PrintNativeBacktrace},
   {"GetBacktrace",         GetBacktrace},
   {"GetNativeBacktrace",   GetNativeBacktrace},
+  {"SetOpcodeTrace",       SetOpcodeTrace},
+  {"GetNativeStats",       GetNativeStats},
+  {"PrintNativeStats",     PrintNativeStats},
+  {"GetPublicStats",       GetPublicStats},
+  {"PrintPublicStats",     PrintPublicStats},
   // Backwards compatibility:
   {"PrintAmxBacktrace",    PrintBacktrace},
   {"GetAmxBacktrace",      GetBacktrace}
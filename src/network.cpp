@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <thread>
 #include <functional>
@@ -13,24 +14,34 @@
 
 using namespace asio::ip;
 
-namespace {
-
-inline std::shared_ptr<asio::streambuf> SerializeResponse(Response &response) {
-  auto b = std::make_shared<asio::streambuf>();
-  std::ostream os(b.get());
-  response.SerializeToOstream(&os);
-  return b;
-}
-
-}
-
 Network::Network()
-  : acceptor_(server_io_, tcp::endpoint(tcp::v4(), 7667))
+  : acceptor_(server_io_),
+    trace_timer_(server_io_),
+    num_connections_(0),
+    client_generation_(0),
+    next_script_id_(0)
 {
-  StartAccept();
 }
 
 void Network::Start() {
+  tcp::endpoint endpoint(tcp::v4(), kPort);
+  std::error_code error;
+
+  acceptor_.open(endpoint.protocol(), error);
+  if (!error) {
+    acceptor_.set_option(tcp::acceptor::reuse_address(true), error);
+    acceptor_.bind(endpoint, error);
+  }
+  if (!error) {
+    acceptor_.listen(asio::socket_base::max_connections, error);
+  }
+  if (error) {
+    std::cerr << "Could not listen on port " << kPort << ": " << error.message() << std::endl;
+    return;
+  }
+  StartAccept();
+  StartTraceTimer();
+
   // `io_service` has two templates for `run` and can't pass it directly without ugly casting
   auto bound = [this] { return server_io_.run(); };
   network_thread_ = std::thread(bound);
@@ -38,10 +49,33 @@ void Network::Start() {
 
 void Network::Stop() {
   server_io_.stop();
-  network_thread_.join();
+  if (network_thread_.joinable()) {
+    network_thread_.join();
+  }
   server_io_.reset();
 }
 
+int Network::AddScript(const std::string &name,
+                       AttachHandler attach_handler,
+                       TaskHandler task_handler,
+                       TraceBuffer *traces) {
+  auto script = std::make_shared<Script>();
+  script->name = name;
+  script->attach_handler = attach_handler;
+  script->task_handler = task_handler;
+  script->traces = traces;
+
+  std::lock_guard<std::mutex> lock(scripts_mutex_);
+  int id = ++next_script_id_;
+  scripts_[id] = script;
+  return id;
+}
+
+void Network::RemoveScript(int script) {
+  std::lock_guard<std::mutex> lock(scripts_mutex_);
+  scripts_.erase(script);
+}
+
 void Network::StartAccept() {
   NetworkConnection::pointer new_connection = NetworkConnection::Create(acceptor_.get_io_service(), this);
 
@@ -53,37 +87,203 @@ void Network::HandleAccept(NetworkConnection::pointer connection, const std::err
   if (error) return;
 
   connections_.push_back(connection);
+  client_generation_++;
+  if (num_connections_++ == 0) {
+    NotifyAttach(true);
+  }
 
   connection->Start();
   StartAccept();
+
+  // Tell the new client (and everyone else) which scripts there are.
+  SendScripts();
 }
 
 void Network::EndConnection(NetworkConnection::pointer connection) {
   connections_.erase(std::remove(connections_.begin(), connections_.end(), connection), connections_.end());
+  if (--num_connections_ == 0) {
+    NotifyAttach(false);
+  }
 }
 
-Task Network::GetTask() {
-  return pending_tasks_.dequeue();
+void Network::NotifyAttach(bool attached) {
+  std::lock_guard<std::mutex> lock(scripts_mutex_);
+  for (auto &entry : scripts_) {
+    Script &script = *entry.second;
+    if (!attached) {
+      script.pending_tasks.clear();
+    }
+    if (script.attach_handler) {
+      script.attach_handler(attached);
+    }
+  }
 }
 
-bool Network::HasTask() {
-  return !pending_tasks_.empty();
+bool Network::WaitForTask(int script, Task &task, int timeout_ms) {
+  std::shared_ptr<Script> target;
+  {
+    std::lock_guard<std::mutex> lock(scripts_mutex_);
+    auto iterator = scripts_.find(script);
+    if (iterator == scripts_.end()) {
+      return false;
+    }
+    target = iterator->second;
+  }
+  return target->pending_tasks.dequeue_for(task, std::chrono::milliseconds(timeout_ms));
 }
 
-void Network::AddTask(Task task) {
-  pending_tasks_.enqueue(task);
+void Network::AddTask(const Task &task) {
+  if (task.type() == Task::QUERY_SCRIPTS) {
+    SendScripts();
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(scripts_mutex_);
+  auto iterator = scripts_.find(task.script());
+  if (iterator == scripts_.end()) {
+    Response response;
+    response.set_type(Response::UNKNOWN);
+    response.set_script(task.script());
+    SendResponseToAll(response);
+    return;
+  }
+
+  Script &script = *iterator->second;
+  if (script.task_handler && script.task_handler(task)) {
+    return;
+  }
+  script.pending_tasks.enqueue(task);
 }
 
-void Network::SendSuccess() {
+void Network::SendScripts() {
+  Response response;
+  response.set_type(Response::SCRIPTS);
+  {
+    std::lock_guard<std::mutex> lock(scripts_mutex_);
+    for (auto &entry : scripts_) {
+      Response::Script *script = response.add_scripts();
+      script->set_id(entry.first);
+      script->set_name(entry.second->name);
+    }
+  }
+  SendResponseToAll(response);
+}
+
+void Network::StartTraceTimer() {
+  trace_timer_.expires_from_now(std::chrono::milliseconds(kTraceInterval));
+  trace_timer_.async_wait([this](const std::error_code &error) {
+    if (error) return;
+    SendTraces();
+    StartTraceTimer();
+  });
+}
+
+void Network::SendTraces() {
+  // Runs on the network thread, which is the only reader of trace buffers.
+  // Buffers are drained even if nobody's listening so that a client that
+  // connects later doesn't get stale records.
+  std::lock_guard<std::mutex> lock(scripts_mutex_);
+  for (auto &entry : scripts_) {
+    TraceBuffer *traces = entry.second->traces;
+    if (traces == nullptr) {
+      continue;
+    }
+    for (;;) {
+      Response response;
+      response.set_type(Response::TRACE);
+      response.set_script(entry.first);
+
+      TraceRecord record;
+      int n = 0;
+      while (n < kMaxTracesPerResponse && traces->Pop(record)) {
+        Response::Trace *trace = response.add_traces();
+        trace->set_instruction_pointer(record.address);
+        trace->set_time(record.time);
+        for (int i = 0; i < record.num_values; i++) {
+          trace->add_values(record.values[i]);
+        }
+        n++;
+      }
+      response.set_traces_dropped(traces->TakeDropped());
+
+      if ((n > 0 || response.traces_dropped() > 0) && num_connections_ > 0) {
+        SendResponseToAll(response);
+      }
+      if (n < kMaxTracesPerResponse) {
+        break;
+      }
+    }
+  }
+}
+
+void Network::SendSuccess(int script) {
   Response response;
   response.set_type(Response::SUCCESS);
+  response.set_script(script);
   SendResponseToAll(response);
 }
 
-void Network::SendRegisters(AMXScript amx) {
+void Network::SendRegisters(int script, AMXScript amx) {
   Response response;
   response.set_type(Response::REGISTERS);
+  response.set_script(script);
+  FillRegisters(response, amx);
+  SendResponseToAll(response);
+}
+
+void Network::SendStopped(int script, AMXScript amx, AMXSnapshot &snapshot,
+                          const Response::Watchpoint *watchpoint) {
+  Response response;
+  response.set_type(Response::STOPPED);
+  response.set_script(script);
+  if (watchpoint != 0) {
+    *response.mutable_watchpoint() = *watchpoint;
+  }
+  snapshot.Update(amx, response.mutable_snapshot());
+  SendResponseToAll(response);
+}
+
+void Network::SendMemory(int script, cell start, cell stride,
+                         const cell *values, std::size_t count) {
+  std::size_t offset = 0;
+  do {
+    std::size_t n = std::min(count - offset, kMemoryChunkSize);
+
+    Response response;
+    response.set_type(Response::MEMORY);
+    response.set_script(script);
+    Response::Memory *memory = response.mutable_memory();
+    memory->set_address(start + static_cast<cell>(offset) * stride);
+    memory->mutable_values()->Reserve(static_cast<int>(n));
+    for (std::size_t i = 0; i < n; i++) {
+      memory->add_values(values[offset + i]);
+    }
+    offset += n;
+    memory->set_more(offset < count);
 
+    SendResponseToAll(response);
+  } while (offset < count);
+}
+
+void Network::SendVariable(int script, Response::Variable &variable) {
+  Response response;
+  response.set_type(Response::VARIABLE);
+  response.set_script(script);
+  response.mutable_variable()->Swap(&variable);
+  SendResponseToAll(response);
+}
+
+void Network::SendNativeStats(
+    int script,
+    google::protobuf::RepeatedPtrField<Response::NativeStats> &stats) {
+  Response response;
+  response.set_type(Response::NATIVE_STATS);
+  response.set_script(script);
+  response.mutable_native_stats()->Swap(&stats);
+  SendResponseToAll(response);
+}
+
+void Network::FillRegisters(Response &response, AMXScript amx) {
   Response::Registers *registers = response.mutable_registers();
 
   registers->set_pri(amx.GetPri());
@@ -95,21 +295,32 @@ void Network::SendRegisters(AMXScript amx) {
   registers->set_frm(amx.GetFrm());
   registers->set_cip(amx.GetCip());
 
+  // Offsets of the code and data sections in the image, like COD and DAT
+  // in the abstract machine.
   AMX_HEADER *header = amx.GetHeader();
-  registers->set_cod(*(amx.amx()->base + header->cod));
-  registers->set_dat(*(amx.amx()->base + header->dat));
-
-  SendResponseToAll(response);
+  registers->set_cod(header->cod);
+  registers->set_dat(header->dat);
 }
 
 void Network::SendResponseToAll(Response &response) {
-  std::shared_ptr<asio::streambuf> serializedBuffer = SerializeResponse(response);
+  // Serialize once for all clients, into a recycled buffer.
+  ResponseBuffer *buffer = response_buffers_.Acquire();
+  buffer->Assign(response);
 
-  for (auto &connection : connections_) {
-    connection->SendResponse(serializedBuffer);
-  }
+  // Connections belong to the network thread; this may be called from the
+  // server thread, which must never wait for a socket.
+  server_io_.post([this, buffer] {
+    for (auto &connection : connections_) {
+      buffer->AddRef();
+      connection->SendResponse(buffer);
+    }
+    response_buffers_.Release(buffer);
+  });
 }
 
-void Network::SendConfusion() {
-
+void Network::SendConfusion(int script) {
+  Response response;
+  response.set_type(Response::UNKNOWN);
+  response.set_script(script);
+  SendResponseToAll(response);
 }
\ No newline at end of file
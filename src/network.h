@@ -1,40 +1,126 @@
 #ifndef NETWORK_H
 #define NETWORK_H
 
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
 
 #include "asio.hpp"
 
 #include "amxexecutor.h"
+#include "amxsnapshot.h"
 #include "networkconnection.h"
+#include "responsebuffer.h"
 #include "safequeue.h"
+#include "tracebuffer.h"
 #include "proto/task.pb.h"
 #include "proto/response.pb.h"
 
+// The debug server. There is one per process: it listens on a single port
+// and runs a single network thread for all loaded scripts. Scripts register
+// themselves under an ID; tasks are routed by the ID they carry, and
+// responses carry the ID of the script they're about.
 class Network {
  public:
+  static const unsigned short kPort = 7667;
+
+  // Called with true when the first client connects and with false when
+  // the last one disconnects.
+  typedef std::function<void(bool)> AttachHandler;
+
+  // Gets a look at every task for the script as soon as it arrives, on the
+  // network thread. Returns true if it took care of the task, in which case
+  // the task is not queued for WaitForTask().
+  typedef std::function<bool(const Task &)> TaskHandler;
+
   Network();
 
   void Start();
   void Stop();
-  Task GetTask();
-  void AddTask(Task);
-  bool HasTask();
+
+  // Returns the ID of the newly registered script. The handlers are never
+  // called, and traces never read, after RemoveScript() returns. What the
+  // script records into traces is sent as TRACE responses every
+  // kTraceInterval milliseconds.
+  int AddScript(const std::string &name,
+                AttachHandler attach_handler,
+                TaskHandler task_handler,
+                TraceBuffer *traces);
+  void RemoveScript(int script);
+
+  bool IsClientConnected() const { return num_connections_ > 0; }
+
+  // Goes up every time a client connects.
+  int client_generation() const { return client_generation_; }
+
+  // Waits up to timeout_ms for a task to arrive. Returns false if none did.
+  bool WaitForTask(int script, Task &task, int timeout_ms);
+  void AddTask(const Task &);
   void EndConnection(NetworkConnection::pointer);
+  ResponseBufferPool &response_buffers() { return response_buffers_; }
 
-  void SendSuccess();
-  void SendRegisters(AMXScript amx);
-  void SendConfusion();
+  void SendSuccess(int script);
+  void SendRegisters(int script, AMXScript amx);
+  void SendStopped(int script, AMXScript amx, AMXSnapshot &snapshot,
+                   const Response::Watchpoint *watchpoint);
+
+  // Sends count cells as one or more MEMORY responses. Cell i is reported
+  // at address start + i * stride.
+  void SendMemory(int script, cell start, cell stride,
+                  const cell *values, std::size_t count);
+
+  // Takes the contents of variable.
+  void SendVariable(int script, Response::Variable &variable);
+
+  // Takes the contents of stats.
+  void SendNativeStats(
+    int script,
+    google::protobuf::RepeatedPtrField<Response::NativeStats> &stats);
+  void SendConfusion(int script);
  private:
+  struct Script {
+    std::string name;
+    AttachHandler attach_handler;
+    TaskHandler task_handler;
+    TraceBuffer *traces;
+    SafeQueue<Task> pending_tasks;
+  };
+
   void StartAccept();
   void HandleAccept(NetworkConnection::pointer, const std::error_code&);
+  void NotifyAttach(bool attached);
+  void SendScripts();
+  void StartTraceTimer();
+  void SendTraces();
+  // Cells per MEMORY response. Keeps replies well below the size at which
+  // response buffers stop being recycled.
+  static const std::size_t kMemoryChunkSize = 16384;
+  // How often trace buffers are drained (in milliseconds), and into how
+  // big responses.
+  static const int kTraceInterval = 20;
+  static const int kMaxTracesPerResponse = 1024;
+
   void SendResponseToAll(Response &);
+  static void FillRegisters(Response &, AMXScript amx);
 
-  SafeQueue<Task> pending_tasks_;
   std::thread network_thread_;
   asio::io_service server_io_;
   asio::ip::tcp::acceptor acceptor_;
-  std::vector<NetworkConnection::pointer> connections_; 
+  asio::steady_timer trace_timer_;
+  std::vector<NetworkConnection::pointer> connections_;
+  std::atomic<int> num_connections_;
+  std::atomic<int> client_generation_;
+  ResponseBufferPool response_buffers_;
+
+  // Handlers are called with the lock held, so that RemoveScript() can't
+  // pull a script out from under them.
+  std::mutex scripts_mutex_;
+  std::map<int, std::shared_ptr<Script>> scripts_;
+  int next_script_id_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,4 +1,6 @@
 #include <array>
+#include <cstring>
+#include <functional>
 #include <iostream>
 
 #include "asio.hpp"
@@ -16,20 +18,14 @@ inline std::uint32_t BytesToUInt(const std::array<unsigned char, 4> &bytes) {
          bytes[2] << 8 |
          bytes[3];
 }
-
-inline std::array<unsigned char, 4> UIntToBytes(const std::uint32_t value) {
-  std::array<unsigned char, 4> bytes;
-  for (size_t i = 0; i != 4; ++i) {
-    bytes[3 - i] = value >> (i * 8);
-  }
-
-  return bytes;
-}
 }
 
 NetworkConnection::NetworkConnection(asio::io_service& io_service, Network *network)
-  : socket_(io_service),
-    network_(network)
+  : network_(network),
+    socket_(io_service),
+    read_size_(0),
+    outgoing_size_(0),
+    closed_(false)
 {
 }
 
@@ -38,49 +34,144 @@ NetworkConnection::pointer NetworkConnection::Create(asio::io_service& io_servic
 }
 
 void NetworkConnection::Start() {
-  while (true) {
-    if (ReadTask()) break;
+  ReadTasks();
+}
+
+void NetworkConnection::ReadTasks() {
+  if (read_buffer_.size() - read_size_ < kReadChunkSize) {
+    read_buffer_.resize(read_size_ + kReadChunkSize);
+  }
+
+  socket_.async_read_some(
+    asio::buffer(read_buffer_.data() + read_size_, read_buffer_.size() - read_size_),
+    std::bind(&NetworkConnection::HandleReadTasks, shared_from_this(),
+              std::placeholders::_1, std::placeholders::_2));
+}
+
+void NetworkConnection::HandleReadTasks(const std::error_code &error, std::size_t bytes_transferred) {
+  if (error) {
+    Close(error);
+    return;
   }
+
+  read_size_ += bytes_transferred;
+  if (!ParseTasks()) {
+    Close(std::error_code());
+    return;
+  }
+
+  ReadTasks();
 }
 
-int NetworkConnection::ReadTask() {
-  std::array<unsigned char, 4> expected_bytes_bytes;
-  asio::error_code error_code;
-  size_t bytes_transferred = 0;
+bool NetworkConnection::ParseTasks() {
+  // A single read may bring in several frames as well as part of the next
+  // one. Parse every complete frame right where it is, then move what's
+  // left to the front of the buffer.
+  const unsigned char *begin = read_buffer_.data();
+  const unsigned char *end = begin + read_size_;
+  const unsigned char *frame = begin;
+
+  while (end - frame >= 4) {
+    std::array<unsigned char, 4> size_bytes = {{frame[0], frame[1], frame[2], frame[3]}};
+    std::uint32_t size = BytesToUInt(size_bytes);
+    if (size > kMaxTaskSize) {
+      std::cerr << "Task is too big: " << size << " bytes" << std::endl;
+      return false;
+    }
+    if (static_cast<std::size_t>(end - frame - 4) < size) {
+      break;
+    }
+
+    // Reusing the same message keeps the allocations it made last time.
+    if (!task_.ParseFromArray(frame + 4, static_cast<int>(size))) {
+      std::cerr << "Could not parse task" << std::endl;
+      return false;
+    }
+    network_->AddTask(task_);
+    frame += 4 + size;
+  }
 
-  bytes_transferred = asio::read(socket_, asio::buffer(expected_bytes_bytes), asio::transfer_exactly(4), error_code);
-  
-  if (error_code) {
-    std::cerr << "Error: " << error_code.message() << std::endl;
+  read_size_ = end - frame;
+  if (frame != begin && read_size_ > 0) {
+    std::memmove(read_buffer_.data(), frame, read_size_);
+  }
+  return true;
+}
 
-    return 1;
+void NetworkConnection::SendResponse(ResponseBuffer *response) {
+  if (closed_) {
+    network_->response_buffers().Release(response);
+    return;
   }
 
-  std::uint32_t expected_bytes = BytesToUInt(expected_bytes_bytes);
+  // Not closed right here: the network may be going through its list of
+  // connections.
+  if (outgoing_size_ + response->size() > kMaxQueuedBytes) {
+    network_->response_buffers().Release(response);
+    socket_.get_io_service().post(
+      std::bind(&NetworkConnection::Close, shared_from_this(),
+                std::make_error_code(std::errc::no_buffer_space)));
+    return;
+  }
 
-  bytes_transferred = asio::read(socket_, buffer_, asio::transfer_exactly(expected_bytes), error_code);
+  outgoing_.push_back(response);
+  outgoing_size_ += response->size();
 
-  if (error_code) {
-    std::cerr << "Error: " << error_code.message() << std::endl;
+  // Otherwise the write in progress will pick it up when it's done.
+  if (writing_.empty()) {
+    WriteResponses();
+  }
+}
 
-    return 1;
+void NetworkConnection::WriteResponses() {
+  while (!outgoing_.empty() && writing_.size() < kMaxResponsesPerWrite) {
+    ResponseBuffer *response = outgoing_.front();
+    outgoing_.pop_front();
+    outgoing_size_ -= response->size();
+    writing_.push_back(response);
+    write_buffers_.push_back(asio::buffer(response->data(), response->size()));
   }
 
-  Task task;
-  if (!task.ParseFromIstream(&std::istream(&buffer_))) {
-    std::cerr << "Could not parse task" << std::endl;
+  asio::async_write(socket_, write_buffers_,
+    std::bind(&NetworkConnection::HandleWriteResponses, shared_from_this(), std::placeholders::_1));
+}
 
-    return 1; 
+void NetworkConnection::HandleWriteResponses(const std::error_code &error) {
+  for (ResponseBuffer *response : writing_) {
+    network_->response_buffers().Release(response);
   }
+  writing_.clear();
+  write_buffers_.clear();
 
-  network_->AddTask(task);
+  if (error) {
+    Close(error);
+    return;
+  }
 
-  return 0;
+  if (!outgoing_.empty()) {
+    WriteResponses();
+  }
 }
 
-void NetworkConnection::SendResponse(std::shared_ptr<asio::streambuf> response) {
-  std::error_code ec;
+void NetworkConnection::Close(const std::error_code &error) {
+  // Both a read and a write may fail on the same socket.
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+
+  if (error && error != asio::error::eof) {
+    std::cerr << "Error: " << error.message() << std::endl;
+  }
 
-  asio::write(socket_, asio::buffer(UIntToBytes((*response).size())), ec);
-  asio::write(socket_, *response, ec);
-}
\ No newline at end of file
+  std::error_code ignored;
+  socket_.close(ignored);
+
+  // A write in progress will release its own responses when it's aborted.
+  for (ResponseBuffer *response : outgoing_) {
+    network_->response_buffers().Release(response);
+  }
+  outgoing_.clear();
+  outgoing_size_ = 0;
+  network_->EndConnection(shared_from_this());
+}
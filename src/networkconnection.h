@@ -1,12 +1,15 @@
 #ifndef NETWORK_CONNECTION_H
 #define NETWORK_CONNECTION_H
 
+#include <array>
+#include <deque>
 #include <vector>
 #include <istream>
 
 #include "asio.hpp"
 
 #include "networkconnection.h"
+#include "responsebuffer.h"
 #include "proto/response.pb.h"
 #include "proto/task.pb.h"
 
@@ -14,6 +17,10 @@ using namespace asio::ip;
 
 class Network;
 
+// A debugger client. Everything here runs on the network thread: reads are
+// asynchronous and so are writes, which go through a per-connection queue
+// so that a slow client can't hold up anyone else. Whatever piles up in the
+// queue while a write is in progress goes out in a single gather write.
 class NetworkConnection
   : public std::enable_shared_from_this<NetworkConnection>
 {
@@ -24,16 +31,40 @@ class NetworkConnection
     tcp::socket& socket() { return socket_; };
     void Start();
 
-    void SendResponse(std::shared_ptr<asio::streambuf>);
+    // Queues a response and takes over one reference to it. Must be called
+    // on the network thread.
+    void SendResponse(ResponseBuffer *);
 
   private:
+    // Upper limit on responses per write.
+    static const std::size_t kMaxResponsesPerWrite = 64;
+
+    // A client that lets this much pile up isn't reading; it's dropped
+    // rather than allowed to eat the server's memory.
+    static const std::size_t kMaxQueuedBytes = 16 << 20;
+
+    // Tasks are tiny; anything bigger than this is garbage.
+    static const std::size_t kMaxTaskSize = 1 << 20;
+    static const std::size_t kReadChunkSize = 4096;
+
     NetworkConnection(asio::io_service &, Network *);
-    int ReadTask();
-    int ParseTask(std::istream &, Task &);
+    void ReadTasks();
+    void HandleReadTasks(const std::error_code &, std::size_t);
+    bool ParseTasks();
+    void WriteResponses();
+    void HandleWriteResponses(const std::error_code &);
+    void Close(const std::error_code &);
 
     Network *network_;
     tcp::socket socket_;
-    asio::streambuf buffer_;
+    std::vector<unsigned char> read_buffer_;
+    std::size_t read_size_;
+    Task task_;
+    std::deque<ResponseBuffer*> outgoing_;
+    std::size_t outgoing_size_;
+    std::vector<ResponseBuffer*> writing_;
+    std::vector<asio::const_buffer> write_buffers_;
+    bool closed_;
 };
 
-#endif
\ No newline at end of file
+#endif
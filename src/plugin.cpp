@@ -30,6 +30,7 @@
 
 #include "amxerror.h"
 #include "amxexecutor.h"
+#include "amxnameindex.h"
 #include "debugplugin.h"
 #include "fileutils.h"
 #include "logprintf.h"
@@ -49,7 +50,13 @@ static int AMXAPI AmxCallback(AMX *amx, cell index, cell *result, cell *params)
 }
 
 static int AMXAPI AmxExec(AMX *amx, cell *retval, int index) {
-  return AMXExecutor::GetInstance(amx)->HandleAMXExec(retval, index);
+  if ((amx->flags & AMX_FLAG_BROWSE) != 0) {
+    // amx_Init() wants the opcode table to relocate the code with. Give it
+    // ours so that the executor can run the relocated code as is.
+    *retval = reinterpret_cast<cell>(AMXExecutor::GetOpcodeTable());
+    return AMX_ERR_NONE;
+  }
+  return DebugPlugin::GetInstance(amx)->HandleAMXExec(retval, index);
 }
 
 static void AMXAPI AmxExecError(AMX *amx, cell index, cell *retval, int error) {
@@ -84,11 +91,22 @@ PLUGIN_EXPORT bool PLUGIN_CALL Load(void **ppData) {
   os::SetCrashHandler(DebugPlugin::OnCrash);
   os::SetInterruptHandler(DebugPlugin::OnInterrupt);
 
+  DebugPlugin::StartDebugServer();
+  DebugPlugin::StartProfiler();
+  DebugPlugin::StartWatchdog();
+
   logprintf("  DebugPlugin plugin " PROJECT_VERSION_STRING);
   return true;
 }
 
+PLUGIN_EXPORT void PLUGIN_CALL Unload() {
+  DebugPlugin::StopWatchdog();
+  DebugPlugin::StopProfiler();
+  DebugPlugin::StopDebugServer();
+}
+
 PLUGIN_EXPORT int PLUGIN_CALL AmxLoad(AMX *amx) {
+  AMXExecutor::GetInstance(amx)->Load();
   DebugPlugin::CreateInstance(amx)->Load();
 
   amx_SetDebugHook(amx, AmxDebug);
@@ -102,5 +120,7 @@ PLUGIN_EXPORT int PLUGIN_CALL AmxLoad(AMX *amx) {
 PLUGIN_EXPORT int PLUGIN_CALL AmxUnload(AMX *amx) {
   DebugPlugin::GetInstance(amx)->Unload();
   DebugPlugin::DestroyInstance(amx);
+  AMXExecutor::DestroyInstance(amx);
+  AMXNameIndex::DestroyInstance(amx);
   return AMX_ERR_NONE;
 }
@@ -0,0 +1,36 @@
+#include "responsebuffer.h"
+
+void ResponseBuffer::Assign(const Response &response) {
+  std::size_t size = response.ByteSizeLong();
+  bytes_.resize(4 + size);
+  bytes_[0] = static_cast<unsigned char>(size >> 24);
+  bytes_[1] = static_cast<unsigned char>(size >> 16);
+  bytes_[2] = static_cast<unsigned char>(size >> 8);
+  bytes_[3] = static_cast<unsigned char>(size);
+  response.SerializeWithCachedSizesToArray(bytes_.data() + 4);
+}
+
+ResponseBuffer *ResponseBufferPool::Acquire() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ResponseBuffer *buffer;
+  if (free_.empty()) {
+    buffers_.emplace_back(new ResponseBuffer);
+    buffer = buffers_.back().get();
+  } else {
+    buffer = free_.back();
+    free_.pop_back();
+  }
+  buffer->refs_ = 1;
+  return buffer;
+}
+
+void ResponseBufferPool::Release(ResponseBuffer *buffer) {
+  if (!buffer->Release()) {
+    return;
+  }
+  if (buffer->bytes_.capacity() > kMaxRetainedSize) {
+    std::vector<unsigned char>().swap(buffer->bytes_);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.push_back(buffer);
+}
@@ -0,0 +1,57 @@
+#ifndef RESPONSE_BUFFER_H
+#define RESPONSE_BUFFER_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "proto/response.pb.h"
+
+// A serialized response, ready to be written to a socket as is: a 4-byte
+// big-endian length followed by the message.
+//
+// Buffers are recycled through a ResponseBufferPool, so once the pool has
+// warmed up sending a response doesn't allocate. A buffer is shared by all
+// connections it's sent to; the reference count is only touched on the
+// network thread.
+class ResponseBuffer {
+ public:
+  ResponseBuffer() : refs_(0) {}
+
+  void Assign(const Response &response);
+
+  const unsigned char *data() const { return bytes_.data(); }
+  std::size_t size() const { return bytes_.size(); }
+
+  void AddRef() { refs_++; }
+  bool Release() { return --refs_ == 0; }
+
+ private:
+  friend class ResponseBufferPool;
+
+  std::vector<unsigned char> bytes_;
+  int refs_;
+};
+
+class ResponseBufferPool {
+ public:
+  // Returns a buffer with one reference. Can be called from any thread.
+  ResponseBuffer *Acquire();
+
+  // Drops a reference and recycles the buffer when it was the last one.
+  // Can be called from any thread but never concurrently for the same
+  // buffer.
+  void Release(ResponseBuffer *buffer);
+
+ private:
+  // Buffers that grew bigger than this (e.g. for a memory dump) aren't
+  // kept around at that size.
+  static const std::size_t kMaxRetainedSize = 1 << 20;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ResponseBuffer>> buffers_;
+  std::vector<ResponseBuffer*> free_;
+};
+
+#endif
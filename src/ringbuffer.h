@@ -0,0 +1,61 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// A fixed-size ring with one producer and one consumer thread that never
+// blocks or allocates. When it's full new items are dropped and counted
+// instead, so the producer (usually a running script) never waits.
+template <typename T, std::size_t Capacity>
+class RingBuffer {
+ public:
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+  RingBuffer()
+   : items_(new T[Capacity]),
+     head_(0),
+     tail_(0),
+     dropped_(0)
+  {}
+
+  // Producer side.
+  bool Push(const T &item) {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == Capacity) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    items_[head & (Capacity - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side.
+  bool Pop(T &item) {
+    std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = items_[tail & (Capacity - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns the number of items dropped since the last call.
+  uint32_t TakeDropped() {
+    return dropped_.exchange(0, std::memory_order_relaxed);
+  }
+
+ private:
+  std::unique_ptr<T[]> items_;
+  // Kept apart so that the two threads don't fight over a cache line.
+  alignas(64) std::atomic<std::size_t> head_;
+  alignas(64) std::atomic<std::size_t> tail_;
+  std::atomic<uint32_t> dropped_;
+};
+
+#endif // !RINGBUFFER_H
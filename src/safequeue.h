@@ -3,6 +3,7 @@
 #ifndef SAFE_QUEUE_H
 #define SAFE_QUEUE_H
 
+#include <chrono>
 #include <queue>
 #include <mutex>
 #include <condition_variable>
@@ -41,6 +42,27 @@ public:
     return val;
   }
 
+  // Like dequeue() but gives up after the specified time. Returns false if
+  // the queue was still empty by then.
+  template <class Rep, class Period>
+  bool dequeue_for(T &t, const std::chrono::duration<Rep, Period> &timeout)
+  {
+    std::unique_lock<std::mutex> lock(m);
+    if(!c.wait_for(lock, timeout, [this] { return !q.empty(); }))
+    {
+      return false;
+    }
+    t = q.front();
+    q.pop();
+    return true;
+  }
+
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(m);
+    q = std::queue<T>();
+  }
+
   bool empty()
   {
     std::unique_lock<std::mutex> lock(m);
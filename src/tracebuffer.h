@@ -0,0 +1,23 @@
+#ifndef TRACEBUFFER_H
+#define TRACEBUFFER_H
+
+#include <cstdint>
+
+#include <amx/amx.h>
+
+#include "ringbuffer.h"
+
+// What a tracepoint records on a hit.
+struct TraceRecord {
+  static const int kMaxValues = 8;
+
+  cell address;
+  int64_t time; // microseconds, steady clock
+  int num_values;
+  cell values[kMaxValues];
+};
+
+// Carries trace records from the script's thread to the network thread.
+typedef RingBuffer<TraceRecord, 4096> TraceBuffer;
+
+#endif // !TRACEBUFFER_H